@@ -2,7 +2,9 @@
 
 #include "psarc_archive.hpp"
 #include "psarc_compression.hpp"
+#include "psarc_diff.hpp"
 #include "psarc_error.hpp"
 #include "psarc_impl.hpp"
 #include "psarc_memory.hpp"
+#include "psarc_path_index.hpp"
 #include "psarc_types.hpp"
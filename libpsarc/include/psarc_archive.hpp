@@ -1,20 +1,31 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <optional>
-#include <queue>
 #include <set>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 #include "psarc_error.hpp"
+#include "psarc_memory.hpp"
+#include "psarc_path_index.hpp"
 #include "psarc_types.hpp"
 
 namespace PSArc {
 
 class ArchiveSyncSettings {};
+class BlockCompressionCache;
 
 /*
  * Abstract template for synchronizing the state of an archive from its
@@ -30,15 +41,28 @@ public:
 
 struct FileData {
   std::vector<byte> bytes;
-  std::vector<size_t> compressedBlockSizes;
-  std::vector<bool> blockIsCompressed;
+  std::vector<BlockDescriptor> blocks;
   CompressionType compressionType = CompressionType::PSARC_COMPRESSION_TYPE_NONE;
   size_t uncompressedMaxBlockSize = 0;
   size_t uncompressedTotalSize    = 0;
   size_t compressedMaxBlockSize   = 0;
 
-  void Compress(FileData& dst);
-  void Decompress(FileData& dst);
+  FileData()                           = default;
+  FileData(const FileData&)            = default;
+  FileData(FileData&&)                 = default;
+  FileData& operator=(const FileData&) = default;
+  FileData& operator=(FileData&&)      = default;
+  /* Hands the content buffer back to the BufferPool. */
+  ~FileData();
+
+  void Compress(FileData& dst, BlockCompressionCache* blockCache = nullptr) const;
+  void Decompress(FileData& dst) const;
+  /*
+   * Decompresses blockCount blocks starting at firstBlock into dst. The size of dst must match the uncompressed size of these blocks.
+   * Returns false if the block range or the size of dst is invalid or if decompression failed.
+   */
+  bool DecompressInto(std::span<byte> dst, size_t firstBlock, size_t blockCount) const;
+  size_t GetBlockCount() const noexcept;
 };
 
 /*
@@ -50,6 +74,76 @@ public:
   virtual CompressionType GetCompressionType() = 0;
   virtual bool HasUncompressedSize()           = 0;
   virtual size_t GetUncompressedSize()         = 0;
+
+  /*
+   * Block granular access to the content in the layout GetData would return. The default implementations call GetData for every
+   * request, hence files only use them if SupportsBlockAccess returns true. Otherwise GetData is read once and sliced.
+   * ReadBlock reads the stored bytes of a block, the size of dst must match the size in its descriptor.
+   */
+  virtual size_t GetBlockCount();
+  virtual size_t GetMaxBlockSize();
+  virtual BlockDescriptor GetBlockDescriptor(size_t index);
+  virtual bool ReadBlock(size_t index, std::span<byte> dst);
+  /* Returns true if the methods above are overridden to not read the whole content. */
+  virtual bool SupportsBlockAccess();
+  /* Returns true if ReadBlock may be called from several threads at once. */
+  virtual bool SupportsConcurrentReads();
+};
+
+/*
+ * A file on disk whose content is only read when it is requested, nothing is kept in memory by the source itself.
+ */
+class LooseFileSource : public FileSourceProvider {
+private:
+  std::filesystem::path path;
+  std::mutex blockMutex;
+  std::ifstream blockStream;
+  size_t fileSize = 0;
+  bool valid      = false;
+
+public:
+  LooseFileSource(std::filesystem::path _path);
+  FileData GetData() override;
+  CompressionType GetCompressionType() override;
+  bool HasUncompressedSize() override;
+  size_t GetUncompressedSize() override;
+  size_t GetBlockCount() override;
+  size_t GetMaxBlockSize() override;
+  BlockDescriptor GetBlockDescriptor(size_t index) override;
+  /* The file stays open from the first block read until the last block was read. Reads from several threads are serialized. */
+  bool ReadBlock(size_t index, std::span<byte> dst) override;
+  bool SupportsBlockAccess() override;
+  bool SupportsConcurrentReads() override;
+  bool IsValid() const {
+    return this->valid;
+  };
+};
+
+/*
+ * An archive wide memory budget for cached file data.
+ * Only data that can be reloaded from a FileSourceProvider is handed to the cache. Once the budget is exceeded, the least recently used
+ * data is dropped. Data still referenced by a caller stays alive until the caller releases it.
+ */
+class FileCache {
+private:
+  struct Entry {
+    std::shared_ptr<FileData> data;
+    size_t size;
+  };
+
+  std::mutex mutex;
+  std::list<Entry> entries;
+  std::unordered_map<const FileData*, std::list<Entry>::iterator> entryLookup;
+  size_t budget;
+  size_t usage = 0;
+
+public:
+  FileCache(size_t _budget) : budget(_budget) {};
+  /* Inserts data as the most recently used entry or marks it as such if it is already cached. */
+  void Insert(std::shared_ptr<FileData> data);
+  void Erase(const FileData* data);
+  size_t GetUsage();
+  size_t GetBudget();
 };
 
 /*
@@ -59,44 +153,148 @@ public:
  */
 class File {
 private:
-  std::optional<FileData> uncompressedBytes;
-  std::optional<FileData> compressedBytes;
+  /* A cached state is either owned by the file or, if it can be reloaded from the source, by the archive's FileCache. */
+  struct CachedFileData {
+    std::shared_ptr<FileData> owned;
+    std::weak_ptr<FileData> cached;
+  };
+
+  // Cached states are shared with the callers of the getters, hence a state is replaced as a whole and never modified in place.
+  CachedFileData uncompressedBytes;
+  CachedFileData compressedBytes;
+  std::shared_ptr<FileCache> cache;
+  std::shared_ptr<FileSourceProvider> ownedSource;
   FileSourceProvider* source = nullptr;
   bool compressedSource      = false;
 
+  // The path in its absolute form, computed once on construction. The other forms are views into it.
+  std::string absolutePath;
+  bool hasLeadingSlash = false;
+
+  void SetPathStrings();
+  std::shared_ptr<FileData> GetState(const CachedFileData& state) const;
+  /* Like GetState but leaves the cache alone, for queries that must neither allocate nor evict. */
+  std::shared_ptr<FileData> PeekState(const CachedFileData& state) const noexcept;
+  void SetState(CachedFileData& state, std::shared_ptr<FileData> data, bool reloadable);
+  void ClearState(CachedFileData& state);
+  /* The acquire functions load a state like the Load functions but keep it alive for the caller in case it is evicted right away. */
+  std::shared_ptr<FileData> AcquireCompressedState(CompressionType preferredType = CompressionType::PSARC_COMPRESSION_TYPE_LZMA);
+  std::shared_ptr<FileData> AcquireUncompressedState();
+  std::shared_ptr<FileData> CompressState(
+    const FileData& uncompressedData, CompressionType type, size_t blockSize, BlockCompressionCache* blockCache = nullptr);
+  std::shared_ptr<FileData> DecompressState(const FileData& compressedData);
+  /* Streams an uncompressed source block by block through the compressor, the uncompressed content is never held as a whole. */
+  std::shared_ptr<FileData> CompressSourceState(CompressionType type, size_t blockSize, BlockCompressionCache* blockCache);
+  bool DecompressSourceInto(std::span<byte> dst, size_t firstBlock, size_t blockCount);
+  /* Reads a source without block access as a whole into the matching state, returns a nullptr for any other file. */
+  std::shared_ptr<FileData> AcquireWholeSourceState();
+
 public:
   File(std::string name, std::vector<byte> data);
+  /* The file does not take ownership of a raw provider, it has to outlive the file. */
   File(std::string name, FileSourceProvider* provider);
+  File(std::string name, std::shared_ptr<FileSourceProvider> provider);
   void LoadCompressedBytes(CompressionType preferredType = CompressionType::PSARC_COMPRESSION_TYPE_LZMA);
   void LoadUncompressedBytes();
-  const std::shared_ptr<std::vector<byte>> GetCompressedBytes();
-  const std::shared_ptr<std::vector<byte>> GetUncompressedBytes();
+  /* The returned bytes share ownership with the cached state of the file, no copy is made. */
+  std::shared_ptr<const std::vector<byte>> GetCompressedBytes();
+  std::shared_ptr<const std::vector<byte>> GetUncompressedBytes();
   void ClearCompressedBytes();
   void ClearUncompressedBytes();
-  void Compress(CompressionType type, size_t blockSize);
+  /* Blocks found in blockCache are not compressed again, see BlockCompressionCache. */
+  void Compress(CompressionType type, size_t blockSize, BlockCompressionCache* blockCache = nullptr);
+  /* The number of blocks the compressed state has after Compress with blockSize, computed without compressing. */
+  size_t GetCompressedBlockCount(size_t blockSize);
+  /*
+   * Returns true if CompressBlockRange may be called from several threads at once, i.e. the uncompressed content is owned by the
+   * file or can be read from a source that supports concurrent reads.
+   */
+  bool CanCompressBlockRanges() const noexcept;
+  /*
+   * Compresses blockCount blocks starting at firstBlock into dst like Compress would, without changing the states of the file.
+   * The ranges of a file are put together with SetCompressedBlockRanges. Returns false if the range could not be read.
+   */
+  bool CompressBlockRange(
+    CompressionType type, size_t blockSize, size_t firstBlock, size_t blockCount, FileData& dst, BlockCompressionCache* blockCache);
+  /* Replaces the compressed state with the concatenation of ranges, which have to cover the whole file in block order. */
+  void SetCompressedBlockRanges(const std::vector<FileData>& ranges, CompressionType type, size_t blockSize);
   void Decompress();
+  /*
+   * Decompresses the file into caller provided memory of exactly GetUncompressedSize() bytes without caching the result.
+   * The second overload only decompresses blockCount blocks starting at firstBlock, dst must match their uncompressed size.
+   */
+  bool DecompressInto(std::span<byte> dst);
+  bool DecompressInto(std::span<byte> dst, size_t firstBlock, size_t blockCount);
+  /* The block layout the second DecompressInto overload refers to. */
+  size_t GetBlockCount();
+  size_t GetMaxBlockSize();
+  /*
+   * Reads the stored bytes of a block of the compressed state or a compressed source, dst must match the stored size of the block.
+   * offset is the sum of the stored sizes of all preceding blocks, which callers reading the blocks in order keep as a running total.
+   */
+  bool ReadCompressedBlock(size_t index, size_t offset, std::span<byte> dst);
   /* Returns the size of the uncompressed file. Note that this may cause file loads or decompression calls. */
   size_t GetUncompressedSize() const noexcept;
   /* Returns the size of the compressed file. Note that this may cause file loads or compression calls. */
   size_t GetCompressedSize();
+  /* Returns true if the content can be read again from a source, cached states of such a file can always be cleared safely. */
+  bool HasSource() const noexcept;
+  /* Returns true if the content stays available without the compressed state, i.e. it has a source or is held uncompressed. */
+  bool CanClearCompressedBytes() const noexcept;
   bool IsUncompressedSizeAvailable() const noexcept;
   bool IsCompressedSizeAvailable() const noexcept;
-  std::vector<size_t>& GetCompressedBlockSizes();
+  /* Returns true if GetCompressedBlocks and ReadCompressedBlock can be used without compressing the file. */
+  bool HasCompressedBlocks() const noexcept;
+  std::vector<BlockDescriptor> GetCompressedBlocks();
+  /* Hands the reloadable states of the file to fileCache, a nullptr makes the file own all of its states again. */
+  void SetCache(std::shared_ptr<FileCache> fileCache);
   bool IsManifest() const noexcept;
   std::string GetPathString(PathType pathType = PathType::PSARC_PATH_TYPE_RELATIVE) const noexcept;
+  /* Like GetPathString without building a string, the view is valid as long as the file is. */
+  std::string_view GetPathView(PathType pathType = PathType::PSARC_PATH_TYPE_RELATIVE) const noexcept;
+  /* Changes the path of the file, use Archive::Rename for files that are part of an archive. */
+  void SetPath(std::string name);
 
+  /* Set on construction, the cached path strings are derived from it. */
   std::filesystem::path path;
   bool operator==(const File& rhs) {
     return this->path == rhs.path;
   }
 };
 
+/* Allows looking up names with a std::string_view without constructing a std::string. */
+struct PathComponentHash {
+  using is_transparent = void;
+
+  size_t operator()(std::string_view component) const noexcept {
+    return std::hash<std::string_view> {}(component);
+  }
+};
+
+typedef std::unordered_map<std::string, size_t, PathComponentHash, std::equal_to<>> PathComponentMap;
+
+/*
+ * A node of the directory tree. The children are owned by the node arenas of the archive, a directory only links them. Unlinking a
+ * child leaves a nullptr in its vector that iteration skips, the vectors are compacted once most of their entries are empty.
+ */
 class Directory {
 public:
   Directory(std::string _name) : name(_name) {};
   std::string name;
-  std::vector<Directory> subDirectories;
-  std::vector<File> files;
+  std::vector<Directory*> subDirectories;
+  std::vector<File*> files;
+  /* Positions of the children in the vectors above by name, kept in sync by the methods below. */
+  PathComponentMap subDirectoryIndices;
+  PathComponentMap fileIndices;
+
+  Directory* FindSubDirectory(std::string_view childName);
+  File* FindFile(std::string_view fileName);
+  /* The name of the child must not be taken yet. */
+  void LinkSubDirectory(Directory* subDirectory);
+  void LinkFile(std::string fileName, File* file);
+  /* Return the unlinked child or a nullptr if there is no child with that name. */
+  Directory* UnlinkSubDirectory(std::string_view childName);
+  File* UnlinkFile(std::string_view fileName);
   bool operator<(const Directory& c) {
     return this->name < c.name;
   }
@@ -104,8 +302,8 @@ public:
     return this->name > c.name;
   }
   bool operator==(const Directory& rhs) {
-    return (this->name == rhs.name) && (this->subDirectories.size() == rhs.subDirectories.size())
-           && (this->files.size() == rhs.files.size());
+    return (this->name == rhs.name) && (this->subDirectoryIndices.size() == rhs.subDirectoryIndices.size())
+           && (this->fileIndices.size() == rhs.fileIndices.size());
   }
 };
 
@@ -115,101 +313,203 @@ public:
 class Archive {
 protected:
   Directory rootDirectory;
+  // Storage of all directories below the root and all files except the manifest, their addresses stay valid until they are removed.
+  NodeArena<Directory> directoryArena;
+  NodeArena<File> fileArena;
   std::optional<File> manifest;
+  std::shared_ptr<FileCache> cache;
   size_t fileCount = 0;
 
+  /*
+   * Lookup structures that are built on demand and dropped on modification. Copies rebuild them since they point into the files
+   * of the original.
+   */
+  struct DerivedIndices {
+    PathIndex pathIndex;
+    // File lists in iteration order, each terminated by a nullptr that end() points to.
+    std::vector<File*> breadthFirstFiles;
+    std::vector<File*> depthFirstFiles;
+    // Relative paths by their form with ASCII letters folded to lower case, for PSARC_PATH_TYPE_IGNORECASE lookups. Once built it
+    // is updated path by path on modification instead of being dropped.
+    std::unordered_multimap<std::string, std::string, PathComponentHash, std::equal_to<>> caseFoldedPaths;
+    bool pathIndexValid       = false;
+    bool caseFoldedPathsValid = false;
+
+    DerivedIndices() = default;
+    DerivedIndices(const DerivedIndices&) {};
+    DerivedIndices& operator=(const DerivedIndices&) {
+      Reset();
+      return *this;
+    };
+    void Invalidate() noexcept {
+      this->pathIndex.Clear();
+      this->breadthFirstFiles.clear();
+      this->depthFirstFiles.clear();
+      this->pathIndexValid = false;
+    };
+    /* Also drops the case folded paths, for when all files are replaced at once. */
+    void Reset() noexcept {
+      Invalidate();
+      this->caseFoldedPaths.clear();
+      this->caseFoldedPathsValid = false;
+    };
+  };
+  DerivedIndices indices;
+
+  /*
+   * Files staged from several threads until they are committed. Threads are spread over the shards by their id, hence concurrent
+   * StageFile calls rarely wait on each other. Staged files are not taken over by copies.
+   */
+  struct StagedFiles {
+    static constexpr size_t SHARD_COUNT = 16;
+
+    struct Shard {
+      std::mutex mutex;
+      std::vector<File> files;
+    };
+    std::array<Shard, SHARD_COUNT> shards;
+
+    StagedFiles() = default;
+    StagedFiles(const StagedFiles&) {};
+    StagedFiles& operator=(const StagedFiles&) {
+      return *this;
+    };
+  };
+  StagedFiles stagedFiles;
+
 public:
+  enum IterationOrder {
+    // The manifest first, then the files of every directory level by level. This is the order files are written in by default.
+    PSARC_ITERATION_ORDER_BREADTH_FIRST = 0,
+    // The manifest first, then the files of a directory followed by its subdirectories.
+    PSARC_ITERATION_ORDER_DEPTH_FIRST = 1
+  };
+
+  /*
+   * Iterates a flat list of the files that is built once after every modification. Dereferencing the end yields a nullptr.
+   * Iterators are invalidated when the archive is modified.
+   */
   class Iterator {
   private:
-    std::queue<Directory*> dirQueue;
-    std::queue<File*> fileQueue;
+    File* const* position = nullptr;
 
   public:
-    Iterator() {};
-    Iterator(Archive* archive) : dirQueue(), fileQueue() {
-      // It is important that the manifest file is iterated over first.
-      if (archive->manifest.has_value())
-        this->fileQueue.push(std::addressof(archive->manifest.value()));
-
-      std::for_each(archive->rootDirectory.subDirectories.begin(), archive->rootDirectory.subDirectories.end(), [this](Directory& dir) {
-        this->dirQueue.push(std::addressof(dir));
-      });
-      std::for_each(archive->rootDirectory.files.begin(), archive->rootDirectory.files.end(), [this](File& file) {
-        this->fileQueue.push(std::addressof(file));
-      });
-    };
-    const Iterator& operator++() {
-      while (this->fileQueue.empty() && !this->dirQueue.empty()) {
-        Directory* dir = this->dirQueue.front();
-        this->dirQueue.pop();
-
-        std::for_each(dir->files.begin(), dir->files.end(), [this](File& file) { this->fileQueue.push(std::addressof(file)); });
-      }
-
-      if (!this->fileQueue.empty()) {
-        this->fileQueue.pop();
-      }
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = File*;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = File* const*;
+    using reference         = File* const&;
 
+    Iterator() {};
+    Iterator(File* const* _position) : position(_position) {};
+    Iterator& operator++() {
+      ++this->position;
       return *this;
     };
     Iterator operator++(int) {
       Iterator result = *this;
-      ++(*this);
+      ++this->position;
       return result;
     };
-    File* operator*() {
-      while (this->fileQueue.empty() && !this->dirQueue.empty()) {
-        Directory* dir = this->dirQueue.front();
-        this->dirQueue.pop();
-
-        std::for_each(dir->subDirectories.begin(), dir->subDirectories.end(), [this](Directory& subdir) {
-          this->dirQueue.push(std::addressof(subdir));
-        });
-        std::for_each(dir->files.begin(), dir->files.end(), [this](File& file) { this->fileQueue.push(std::addressof(file)); });
-      }
-
-      if (this->fileQueue.empty())
-        return nullptr;
-
-      return this->fileQueue.front();
+    File* operator*() const {
+      return (this->position != nullptr) ? *this->position : nullptr;
     }
-    bool operator==(const Iterator& rhs) {
-      // This should be changed, what makes an iterator be equal to another and how can we do that efficiently?
-      bool foundDifference = false;
-
-      if (this->dirQueue.empty() || rhs.dirQueue.empty())
-        foundDifference = foundDifference || (this->dirQueue.empty() != rhs.dirQueue.empty());
-
-      if (this->fileQueue.empty() || rhs.fileQueue.empty())
-        foundDifference = foundDifference || (this->fileQueue.empty() != rhs.fileQueue.empty());
+    bool operator==(const Iterator& rhs) const {
+      return this->position == rhs.position;
+    }
+    bool operator!=(const Iterator& rhs) const {
+      return this->position != rhs.position;
+    }
+  };
 
-      if (foundDifference)
-        return false;
+  struct FileRange {
+    Iterator first;
+    Iterator last;
 
-      if (!this->dirQueue.empty())
-        foundDifference = foundDifference || (this->dirQueue.front() != rhs.dirQueue.front());
+    Iterator begin() const {
+      return this->first;
+    };
+    Iterator end() const {
+      return this->last;
+    };
+  };
 
-      if (!this->fileQueue.empty())
-        foundDifference = foundDifference || (this->fileQueue.front() != rhs.fileQueue.front());
+private:
+  const std::vector<File*>& GetFileList(IterationOrder order);
+  Directory& GetOrAddDirectory(std::string_view directory);
+  Directory* FindDirectory(std::string_view directory);
+  /* Inserts file into directory under fileName, a file with the same name is replaced. Returns true if the file was new. */
+  bool InsertFile(Directory& directory, std::string_view fileName, File&& file);
+  /* Destroys all nodes below directory and returns the number of files among them. */
+  size_t DestroyChildren(Directory& directory);
+  void CopyChildren(const Directory& source, Directory& target);
+  /* Rebuilds the paths of all files below directory from their position in the tree, directoryPath is the path of directory. */
+  void SetPathsFromTree(Directory& directory, std::string& directoryPath);
+  File* FindFileIgnoreCase(std::string_view name);
+  /* Keeps the case folded paths in sync with the files once they were built. */
+  void AddCaseFoldedPath(std::string_view path);
+  void RemoveCaseFoldedPath(std::string_view path);
 
-      return !foundDifference;
-    }
-    bool operator!=(const Iterator& rhs) {
-      return !this->operator==(rhs);
-    }
-  };
+public:
   Archive() : rootDirectory("root") {};
+  Archive(const Archive& other);
+  Archive(Archive&& other);
+  Archive& operator=(const Archive& other);
+  Archive& operator=(Archive&& other);
+  ~Archive();
   bool AddFile(File file);
+  /*
+   * Adds a batch of files in one pass over the directory tree, which is much faster than adding them one by one. The new files
+   * of a directory are added sorted by name. Like with AddFile a file replaces an existing file with the same path, within the
+   * batch the later file wins.
+   * Returns false if any of the files could not be inserted.
+   */
+  bool AddFiles(std::vector<File> files);
+  /*
+   * Thread safe counterpart to AddFile for ingesting files from several threads at once. A staged file is not part of the archive
+   * until CommitStagedFiles adds all staged files in one batch like AddFiles. Which of several staged files with the same path is
+   * kept is unspecified.
+   */
+  void StageFile(File file);
+  /* Must not run concurrently with StageFile. Returns false if any of the staged files could not be inserted. */
+  bool CommitStagedFiles();
+  /*
+   * Finds a file by its path, a leading '/' is optional. With PSARC_PATH_TYPE_IGNORECASE ASCII letters are compared case
+   * insensitively, if several files only differ in case an exact match is preferred.
+   */
   File* FindFile(const std::string& name, PathType pathType = PathType::PSARC_PATH_TYPE_RELATIVE);
+  /* Removes the file at path, returns false if there is none. */
+  bool RemoveFile(const std::string& path);
+  /* Removes a directory with all files and directories below it, returns false if there is none. */
+  bool RemoveDirectory(const std::string& path);
+  /*
+   * Moves the file or directory at oldPath to newPath. Returns false if there is nothing at oldPath or newPath is taken by a file or a directory.
+   * The paths of all files below a renamed directory are updated.
+   */
+  bool Rename(const std::string& oldPath, const std::string& newPath);
   size_t GetFileCount() const noexcept;
+  /*
+   * Sorted index of the relative paths of all files except the manifest, e.g. to find all files in a directory tree without
+   * iterating the whole archive. The reference and the file pointers stay valid until the archive is modified.
+   */
+  const PathIndex& GetPathIndex();
+  std::vector<File*> FindFilesWithPrefix(const std::string& prefix);
+  std::vector<File*> FindFilesMatching(const std::string& pattern);
+  /*
+   * Limits the memory used by reloadable cached file data of all files in the archive to budget bytes.
+   * A budget of 0 disables eviction.
+   */
+  void SetMemoryBudget(size_t budget);
   void RemoveManifestFile() noexcept {
     this->manifest.reset();
+    this->indices.Invalidate();
   };
+  FileRange GetFiles(IterationOrder order = PSARC_ITERATION_ORDER_BREADTH_FIRST);
   Iterator begin() {
-    return Iterator(this);
+    return GetFiles().begin();
   };
   Iterator end() {
-    return Iterator();
+    return GetFiles().end();
   };
 };
 }  // namespace PSArc
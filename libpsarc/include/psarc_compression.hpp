@@ -1,5 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
 #include <vector>
 
 #include "psarc_archive.hpp"
@@ -7,18 +15,83 @@
 
 namespace PSArc {
 
+/* Returns the number of blocks a file of the given uncompressed size is split into. */
+inline size_t GetBlockCount(size_t uncompressedTotalSize, size_t maxUncompressedBlockSize) {
+  return (maxUncompressedBlockSize == 0) ? 0 : (uncompressedTotalSize + maxUncompressedBlockSize - 1) / maxUncompressedBlockSize;
+}
+
+/* Returns the size of the uncompressed content of the block with the given index. */
+inline size_t GetUncompressedBlockSize(size_t blockIndex, size_t uncompressedTotalSize, size_t maxUncompressedBlockSize) {
+  const size_t blockStart = blockIndex * maxUncompressedBlockSize;
+  return (blockStart < uncompressedTotalSize) ? std::min(maxUncompressedBlockSize, uncompressedTotalSize - blockStart) : 0;
+}
+
+/*
+ * PSArc has no per block compression flag. A block is stored uncompressed if and only if its stored size equals the size of its
+ * uncompressed content. The compressors never emit a compressed block of exactly that size so this rule is authoritative.
+ */
+inline bool IsBlockCompressed(size_t storedBlockSize, size_t uncompressedBlockSize) {
+  return storedBlockSize != uncompressedBlockSize;
+}
+
+/* MD5 of the uncompressed content of a block. */
+typedef std::array<byte, 16> BlockFingerprint;
+
+struct BlockFingerprintHash {
+  size_t operator()(const BlockFingerprint& fingerprint) const noexcept {
+    size_t hash;
+    std::memcpy(&hash, fingerprint.data(), sizeof(hash));
+    return hash;
+  }
+};
+
+/*
+ * Remembers the stored form of uncompressed blocks so that repeated blocks are only compressed once.
+ * A cache must only be used with a single compression type and block size. Every hit is verified against the uncompressed block before
+ * it is reused. Once capacity bytes are cached, new blocks are no longer added.
+ */
+class BlockCompressionCache {
+private:
+  struct CachedBlock {
+    std::vector<byte> bytes;
+    BlockDescriptor descriptor;
+  };
+
+  std::mutex mutex;
+  std::unordered_map<BlockFingerprint, std::shared_ptr<const CachedBlock>, BlockFingerprintHash> cachedBlocks;
+  CompressionType compressionType;
+  size_t capacity;
+  size_t usage                 = 0;
+  std::atomic<size_t> hitCount = 0;
+
+public:
+  BlockCompressionCache(CompressionType _compressionType, size_t _capacity) : compressionType(_compressionType), capacity(_capacity) {};
+  static BlockFingerprint Fingerprint(std::span<const byte> block);
+  /* Writes the stored form of block to dst at offset and returns true if the block was cached. */
+  bool Find(
+    const BlockFingerprint& fingerprint, std::span<const byte> block, std::vector<byte>& dst, size_t offset, BlockDescriptor& descriptor);
+  void Insert(const BlockFingerprint& fingerprint, std::span<const byte> stored, BlockDescriptor descriptor);
+  size_t GetHitCount() const noexcept;
+};
+
 void LZMACompress(
-  std::vector<byte>& dst, const std::vector<byte>& src, std::vector<size_t>& compressedBlockSizes, size_t maxUncompressedBlockSize,
-  size_t maxCompressedBlockSize);
+  std::vector<byte>& dst, const std::vector<byte>& src, std::vector<BlockDescriptor>& blocks, size_t maxUncompressedBlockSize,
+  size_t maxCompressedBlockSize, BlockCompressionCache* blockCache = nullptr);
 size_t LZMADecompress(
-  std::vector<byte>& dst, const std::vector<byte>& src, const std::vector<size_t>& compressedBlockSizes,
-  const std::vector<bool>& blockIsCompressed);
+  std::vector<byte>& dst, const std::vector<byte>& src, const std::vector<BlockDescriptor>& blocks, size_t uncompressedTotalSize = 0);
+
+/* Decompresses a single LZMA block including its 13 byte header into dst which must be exactly the uncompressed size of the block. */
+bool LZMADecompressBlock(std::span<byte> dst, std::span<const byte> src);
 
 void ZLIBCompress(
-  std::vector<byte>& dst, const std::vector<byte>& src, std::vector<size_t>& compressedBlockSizes, size_t maxUncompressedBlockSize,
-  size_t maxCompressedBlockSize);
+  std::vector<byte>& dst, const std::vector<byte>& src, std::vector<BlockDescriptor>& blocks, size_t maxUncompressedBlockSize,
+  size_t maxCompressedBlockSize, BlockCompressionCache* blockCache = nullptr);
+/* If the uncompressed sizes are known, every block is inflated in place. Otherwise the output buffer is grown until it fits. */
 size_t ZLIBDecompress(
-  std::vector<byte>& dst, const std::vector<byte>& src, const std::vector<size_t>& compressedBlockSizes,
-  const std::vector<bool>& blockIsCompressed);
+  std::vector<byte>& dst, const std::vector<byte>& src, const std::vector<BlockDescriptor>& blocks, size_t uncompressedTotalSize = 0,
+  size_t maxUncompressedBlockSize = 0);
+
+/* Decompresses a single ZLIB block into dst which must be exactly the uncompressed size of the block. */
+bool ZLIBDecompressBlock(std::span<byte> dst, std::span<const byte> src);
 
 }  // namespace PSArc
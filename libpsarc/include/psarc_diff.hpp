@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "psarc_archive.hpp"
+#include "psarc_error.hpp"
+
+namespace PSArc {
+
+enum FileDiffStatus {
+  PSARC_FILE_DIFF_STATUS_UNCHANGED = 0,
+  PSARC_FILE_DIFF_STATUS_ADDED     = 1,
+  PSARC_FILE_DIFF_STATUS_REMOVED   = 2,
+  PSARC_FILE_DIFF_STATUS_CHANGED   = 3
+};
+
+struct FileDiff {
+  std::string path;
+  FileDiffStatus status;
+};
+
+struct ArchiveDiff {
+  /* Every file of both archives except the manifest, sorted by relative path. */
+  std::vector<FileDiff> files;
+  size_t addedCount     = 0;
+  size_t removedCount   = 0;
+  size_t changedCount   = 0;
+  size_t unchangedCount = 0;
+  /* Files whose sizes and block layouts matched, hence their stored content had to be compared. */
+  size_t comparedContentCount = 0;
+};
+
+/*
+ * Compares the files of two archives by path. Files are told apart by their uncompressed size and block layout first, only if these
+ * match the stored blocks are compared. Compressed content is compared as it is stored, hence both archives should be written with
+ * the same compression type and block size, otherwise unchanged files may be reported as changed.
+ */
+PSArcStatus DiffArchives(Archive& oldArchive, Archive& newArchive, ArchiveDiff& diff);
+
+}  // namespace PSArc
@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <cstring>
 #include <functional>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -49,6 +50,34 @@ public:
   uint32_t tocEntrySize           = 30;
   PathType pathType               = PathType::PSARC_PATH_TYPE_ABSOLUTE;
   std::endian endianness          = std::endian::native;
+  /* Byte identical files share their data and blocks in the archive instead of being stored once per file. */
+  bool deduplicateFiles = false;
+  /*
+   * Repeated blocks are compressed once and their compressed form is copied. The format has no way to share blocks between files that
+   * are not identical, hence this only saves compression time. blockCacheSize limits the compressed bytes remembered for this.
+   */
+  bool deduplicateBlocks = false;
+  size_t blockCacheSize  = 64 * 1024 * 1024;
+  /*
+   * Files are written while later files are still compressed. At most writeWindow files are compressed ahead of the file that is
+   * written, which bounds the compressed data held in memory. A window of 0 picks one based on the number of threads.
+   */
+  size_t writeWindow = 0;
+  /*
+   * Files of at least two compression tasks are split into ranges of whole blocks of about this many bytes, which are compressed by
+   * several threads. Only applies to files whose content is in memory or can be read concurrently, 0 compresses each file on one thread.
+   */
+  size_t compressionTaskSize = 4 * 1024 * 1024;
+};
+
+/*
+ * Result of a dry run block deduplication analysis, based on block fingerprints.
+ */
+struct BlockDuplicateReport {
+  size_t totalBlocks     = 0;
+  size_t duplicateBlocks = 0;
+  /* Uncompressed bytes in blocks that repeat an earlier block, i.e. data that would not have to be stored if blocks could be shared. */
+  size_t duplicateBytes = 0;
 };
 
 /*
@@ -61,7 +90,10 @@ private:
 public:
   InputMemoryHandle* parsingEndpoint        = nullptr;
   OutputMemoryHandle* serializationEndpoint = nullptr;
-  size_t* blocks                            = nullptr;
+  /* The PSArcFile sources of an archive all read from the parsing endpoint, their reads are serialized with this mutex. */
+  std::mutex parsingMutex;
+  /* The block table, every block is classified once during Upsync. */
+  BlockDescriptor* blocks = nullptr;
   size_t blockSize;
   PathType pathType               = PathType::PSARC_PATH_TYPE_RELATIVE;
   CompressionType compressionType = CompressionType::PSARC_COMPRESSION_TYPE_NONE;
@@ -80,6 +112,8 @@ public:
   PSArcStatus Downsync() override;
   PSArcStatus Downsync(std::function<void(size_t, std::string)> callbackFunc = {});
   PSArcStatus Downsync(PSArcSettings settings, std::function<void(size_t, std::string)> callbackFunc = {});
+  /* Reports how many blocks of the archive's files repeat with the block size of settings without writing anything. */
+  PSArcStatus AnalyzeBlockDuplicates(PSArcSettings settings, BlockDuplicateReport& report);
 };
 
 /*
@@ -90,14 +124,23 @@ private:
   PSArcHandle& psarcHandle;
   TocEntry entry;
   CompressionType compressionType;
+  size_t nextBlockIndex  = 0;
+  size_t nextBlockOffset = 0;
 
 public:
   PSArcFile(PSArcHandle& _psarcHandle, TocEntry _entry, CompressionType _compressionType)
-    : psarcHandle(_psarcHandle), entry(_entry), compressionType(_compressionType) {};
+    : psarcHandle(_psarcHandle), entry(_entry), compressionType(_compressionType), nextBlockOffset(_entry.fileOffset) {};
   FileData GetData() override;
   CompressionType GetCompressionType() override;
   bool HasUncompressedSize() override;
   size_t GetUncompressedSize() override;
+  size_t GetBlockCount() override;
+  size_t GetMaxBlockSize() override;
+  BlockDescriptor GetBlockDescriptor(size_t index) override;
+  /* Reads of all files of the archive are serialized by the parsingMutex of the handle. */
+  bool ReadBlock(size_t index, std::span<byte> dst) override;
+  bool SupportsBlockAccess() override;
+  bool SupportsConcurrentReads() override;
 };
 
 }  // namespace PSArc
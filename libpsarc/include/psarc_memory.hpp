@@ -1,7 +1,14 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
 
 #include "psarc_types.hpp"
 
@@ -45,4 +52,108 @@ public:
   };
 };
 
+/*
+ * A process wide pool of byte buffers for file content. Released buffers keep their capacity and are handed out again, hence
+ * compressing or reading one file after another reuses the memory of the previous files instead of allocating it anew.
+ * Buffers are kept in power of two size classes, acquiring and releasing a buffer does not depend on the number of pooled buffers.
+ * Buffers larger than maxBufferSize and buffers beyond maxPooledBytes are freed on release.
+ */
+class BufferPool {
+private:
+  static constexpr size_t SIZE_CLASS_COUNT = 64;
+  // How many size classes above the one of a request are searched for a pooled buffer.
+  static constexpr size_t MAX_LARGER_SIZE_CLASSES = 2;
+
+  std::mutex mutex;
+  // Size class k holds buffers with a capacity in [2^k, 2^(k+1)), bit k of nonEmptyClasses is set if it holds any.
+  std::array<std::vector<std::vector<byte>>, SIZE_CLASS_COUNT> sizeClasses;
+  uint64_t nonEmptyClasses = 0;
+  size_t pooledBytes       = 0;
+  size_t maxPooledBytes;
+  size_t maxBufferSize;
+
+  std::vector<byte> TakeFrom(size_t sizeClass);
+  /* Frees pooled buffers until the limits are met again, largest size classes first. The mutex must be held. */
+  void Trim();
+
+public:
+  /* The limits of the process wide pool returned by Get unless they are changed with SetLimits. */
+  static constexpr size_t DEFAULT_MAX_POOLED_BYTES = 64 * 1024 * 1024;
+  static constexpr size_t DEFAULT_MAX_BUFFER_SIZE  = 16 * 1024 * 1024;
+
+  BufferPool(size_t _maxPooledBytes, size_t _maxBufferSize) : maxPooledBytes(_maxPooledBytes), maxBufferSize(_maxBufferSize) {};
+
+  /* Returns an empty buffer with a capacity of at least minCapacity, a pooled one if possible. */
+  std::vector<byte> Acquire(size_t minCapacity = 0);
+  void Release(std::vector<byte>&& buffer);
+  /* Pooled buffers that exceed the new limits are freed right away. */
+  void SetLimits(size_t _maxPooledBytes, size_t _maxBufferSize);
+  size_t GetPooledBytes();
+
+  static BufferPool& Get();
+};
+
+enum ScratchBuffer {
+  PSARC_SCRATCH_BUFFER_STORED_BLOCK       = 0,
+  PSARC_SCRATCH_BUFFER_UNCOMPRESSED_BLOCK = 1,
+  PSARC_SCRATCH_BUFFER_PENDING            = 2,
+  PSARC_SCRATCH_BUFFER_COMPRESSED_BLOCK   = 3,
+  PSARC_SCRATCH_BUFFER_COUNT              = 4
+};
+
+/*
+ * Per thread scratch memory for data that does not outlive a call, e.g. a block between reading and decompressing it.
+ * The buffers keep their capacity, a worker stops allocating once it has seen its largest block.
+ */
+std::vector<byte>& GetScratchBuffer(ScratchBuffer buffer);
+
+/*
+ * Allocates objects of type T in chunks, an object never moves until it is destroyed. The slot of a destroyed object is reused by
+ * the next Create. The arena does not know which of its objects are alive, its owner has to destroy them before releasing it.
+ */
+template <typename T>
+class NodeArena {
+private:
+  static constexpr size_t CHUNK_SIZE = 256;
+
+  struct Slot {
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  std::vector<std::unique_ptr<Slot[]>> chunks;
+  std::vector<Slot*> freeSlots;
+  size_t usedChunkSlots = 0;
+
+public:
+  NodeArena()                            = default;
+  NodeArena(const NodeArena&)            = delete;
+  NodeArena(NodeArena&&)                 = default;
+  NodeArena& operator=(const NodeArena&) = delete;
+  NodeArena& operator=(NodeArena&&)      = default;
+
+  template <typename... Args>
+  T* Create(Args&&... args) {
+    Slot* slot = nullptr;
+
+    if (!this->freeSlots.empty()) {
+      slot = this->freeSlots.back();
+      this->freeSlots.pop_back();
+    }
+    else {
+      if (this->chunks.empty() || this->usedChunkSlots == CHUNK_SIZE) {
+        this->chunks.push_back(std::make_unique<Slot[]>(CHUNK_SIZE));
+        this->usedChunkSlots = 0;
+      }
+
+      slot = std::addressof(this->chunks.back()[this->usedChunkSlots++]);
+    }
+
+    return ::new (static_cast<void*>(slot->storage)) T(std::forward<Args>(args)...);
+  }
+  void Destroy(T* object) {
+    object->~T();
+    this->freeSlots.push_back(reinterpret_cast<Slot*>(object));
+  }
+};
+
 }  // namespace PSArc
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace PSArc {
+
+class File;
+
+/*
+ * A sorted index from relative paths to files. Paths are front coded in blocks, every entry only stores the length of the prefix
+ * it shares with the previous path and the remaining suffix. The first path of a block is stored in full, hence lookups binary
+ * search the blocks and decode a single block at most.
+ */
+class PathIndex {
+private:
+  static constexpr size_t BLOCK_ENTRY_COUNT = 16;
+
+  std::vector<char> encodedPaths;
+  std::vector<size_t> blockOffsets;
+  std::vector<File*> files;
+
+  /* Sequentially decodes the paths of the index starting at an arbitrary block. */
+  class Cursor {
+  private:
+    const PathIndex* index;
+    size_t entry;
+    size_t offset;
+    std::string path;
+
+    void Decode();
+
+  public:
+    Cursor(const PathIndex* _index, size_t block);
+    bool IsValid() const noexcept {
+      return this->entry < this->index->files.size();
+    };
+    void Next();
+    const std::string& GetPath() const noexcept {
+      return this->path;
+    };
+    File* GetFile() const noexcept {
+      return this->index->files[this->entry];
+    };
+  };
+
+  std::string_view GetBlockHead(size_t block) const;
+  /* Returns a cursor at the first path that is not less than path. */
+  Cursor LowerBound(std::string_view path) const;
+
+public:
+  /* Replaces the content of the index, the paths must be unique. */
+  void Build(std::vector<std::pair<std::string, File*>> entries);
+  void Clear() noexcept;
+
+  File* Find(std::string_view path) const;
+  /* Returns all files whose path starts with prefix in path order. */
+  std::vector<File*> FindWithPrefix(std::string_view prefix) const;
+  /*
+   * Returns all files whose path matches pattern in path order. '?' matches a single character and '*' any number of characters
+   * except '/', '**' also matches across directories. A '**' component also matches no directory at all.
+   */
+  std::vector<File*> FindMatching(std::string_view pattern) const;
+
+  static bool MatchesGlob(std::string_view path, std::string_view pattern);
+
+  size_t GetSize() const noexcept {
+    return this->files.size();
+  };
+  /* Size of the front coded paths in bytes. */
+  size_t GetEncodedSize() const noexcept {
+    return this->encodedPaths.size();
+  };
+};
+
+}  // namespace PSArc
@@ -100,6 +100,14 @@ struct uint24_t {
   }
 };
 
+/* A block table entry, the size of the block as stored in the archive and whether it has to be decompressed. */
+struct BlockDescriptor {
+  uint32_t compressedSize : 31;
+  uint32_t isCompressed : 1;
+};
+
+static_assert(sizeof(BlockDescriptor) == 4);
+
 template <typename T>
 static inline T swapEndian(T val) {
   static_assert(CHAR_BIT == 8, "CHAR_BIT != 8");
@@ -1,272 +1,1436 @@
 #include "psarc_archive.hpp"
 
 #include <algorithm>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
+#include <iterator>
+#include <thread>
+#include <utility>
 
 #include "psarc_compression.hpp"
 
+void PSArc::FileCache::Insert(std::shared_ptr<FileData> data) {
+  if (data == nullptr)
+    return;
+
+  std::vector<std::shared_ptr<FileData>> evicted;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    auto entry = this->entryLookup.find(data.get());
+    if (entry != this->entryLookup.end()) {
+      this->entries.splice(this->entries.begin(), this->entries, entry->second);
+      return;
+    }
+
+    const size_t size = data->bytes.size();
+    this->entries.push_front(Entry {data, size});
+    this->entryLookup[data.get()] = this->entries.begin();
+    this->usage += size;
+
+    // The newest entry is kept even if it exceeds the budget on its own, it is dropped with the next insertion.
+    while (this->usage > this->budget && this->entries.size() > 1) {
+      Entry& last = this->entries.back();
+      this->usage -= last.size;
+      this->entryLookup.erase(last.data.get());
+      evicted.push_back(std::move(last.data));
+      this->entries.pop_back();
+    }
+  }
+  // Evicted data is released outside of the lock.
+}
+
+void PSArc::FileCache::Erase(const FileData* data) {
+  std::shared_ptr<FileData> erased;
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  auto entry = this->entryLookup.find(data);
+  if (entry == this->entryLookup.end())
+    return;
+
+  this->usage -= entry->second->size;
+  erased = std::move(entry->second->data);
+  this->entries.erase(entry->second);
+  this->entryLookup.erase(entry);
+}
+
+size_t PSArc::FileCache::GetUsage() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->usage;
+}
+
+size_t PSArc::FileCache::GetBudget() {
+  return this->budget;
+}
+
+/* Turns the stored bytes of a single block into its uncompressed content, dst must be the uncompressed size of the block. */
+static bool decompressBlock(PSArc::CompressionType type, const PSArc::BlockDescriptor& block, std::span<byte> dst, std::span<const byte> src) {
+  if (!block.isCompressed) {
+    if (src.size() != dst.size())
+      return false;
+
+    std::memcpy(dst.data(), src.data(), dst.size());
+    return true;
+  }
+
+  switch (type) {
+    case PSArc::CompressionType::PSARC_COMPRESSION_TYPE_LZMA:
+      return PSArc::LZMADecompressBlock(dst, src);
+    case PSArc::CompressionType::PSARC_COMPRESSION_TYPE_ZLIB:
+      return PSArc::ZLIBDecompressBlock(dst, src);
+    default:
+      return false;
+  }
+}
+
+size_t PSArc::FileSourceProvider::GetBlockCount() {
+  return GetData().GetBlockCount();
+}
+
+size_t PSArc::FileSourceProvider::GetMaxBlockSize() {
+  return GetData().uncompressedMaxBlockSize;
+}
+
+PSArc::BlockDescriptor PSArc::FileSourceProvider::GetBlockDescriptor(size_t index) {
+  const FileData data = GetData();
+
+  if (index < data.blocks.size())
+    return data.blocks[index];
+
+  // Uncompressed data does not necessarily come with a block table, every block is stored as is.
+  return BlockDescriptor {uint32_t(GetUncompressedBlockSize(index, data.uncompressedTotalSize, data.uncompressedMaxBlockSize)), false};
+}
+
+bool PSArc::FileSourceProvider::ReadBlock(size_t index, std::span<byte> dst) {
+  const FileData data = GetData();
+
+  size_t offset = 0;
+  if (data.blocks.empty()) {
+    offset = index * data.uncompressedMaxBlockSize;
+  }
+  else {
+    if (index >= data.blocks.size())
+      return false;
+
+    for (size_t i = 0; i < index; i++) {
+      offset += data.blocks[i].compressedSize;
+    }
+  }
+
+  if (offset + dst.size() > data.bytes.size())
+    return false;
+
+  std::memcpy(dst.data(), data.bytes.data() + offset, dst.size());
+  return true;
+}
+
+bool PSArc::FileSourceProvider::SupportsBlockAccess() {
+  return false;
+}
+
+bool PSArc::FileSourceProvider::SupportsConcurrentReads() {
+  return false;
+}
+
+PSArc::LooseFileSource::LooseFileSource(std::filesystem::path _path) : path(std::move(_path)) {
+  std::error_code error;
+  const std::uintmax_t size = std::filesystem::file_size(this->path, error);
+
+  if (!error && std::ifstream(this->path, std::ios::binary).is_open()) {
+    this->fileSize = size_t(size);
+    this->valid    = true;
+  }
+}
+
+PSArc::FileData PSArc::LooseFileSource::GetData() {
+  FileData data;
+  data.uncompressedMaxBlockSize = 65536;
+  data.compressedMaxBlockSize   = 65536;
+
+  std::ifstream stream(this->path, std::ios::binary);
+  data.bytes = BufferPool::Get().Acquire(this->fileSize);
+  data.bytes.resize(this->fileSize);
+
+  if (!stream.read(reinterpret_cast<char*>(data.bytes.data()), std::streamsize(this->fileSize))) {
+    std::cout << "Fatal Error in file source: Failed to read " << this->path.generic_string() << "." << std::endl;
+    data.bytes.clear();
+  }
+
+  data.uncompressedTotalSize = data.bytes.size();
+  return data;
+}
+
+PSArc::CompressionType PSArc::LooseFileSource::GetCompressionType() {
+  return CompressionType::PSARC_COMPRESSION_TYPE_NONE;
+}
+
+bool PSArc::LooseFileSource::HasUncompressedSize() {
+  return true;
+}
+
+size_t PSArc::LooseFileSource::GetUncompressedSize() {
+  return this->fileSize;
+}
+
+size_t PSArc::LooseFileSource::GetBlockCount() {
+  return PSArc::GetBlockCount(this->fileSize, GetMaxBlockSize());
+}
+
+size_t PSArc::LooseFileSource::GetMaxBlockSize() {
+  return 65536;
+}
+
+PSArc::BlockDescriptor PSArc::LooseFileSource::GetBlockDescriptor(size_t index) {
+  return BlockDescriptor {uint32_t(GetUncompressedBlockSize(index, this->fileSize, GetMaxBlockSize())), false};
+}
+
+bool PSArc::LooseFileSource::ReadBlock(size_t index, std::span<byte> dst) {
+  const size_t offset = index * GetMaxBlockSize();
+
+  if (index >= GetBlockCount() || dst.size() != GetUncompressedBlockSize(index, this->fileSize, GetMaxBlockSize()))
+    return false;
+
+  std::lock_guard<std::mutex> lock(this->blockMutex);
+
+  if (!this->blockStream.is_open())
+    this->blockStream.open(this->path, std::ios::binary);
+
+  this->blockStream.seekg(std::streamoff(offset));
+  const bool success = bool(this->blockStream.read(reinterpret_cast<char*>(dst.data()), std::streamsize(dst.size())));
+
+  // Packing touches every file of a tree, hence a file is not kept open once it was read completely.
+  if (!success || index + 1 == GetBlockCount())
+    this->blockStream.close();
+
+  return success;
+}
+
+bool PSArc::LooseFileSource::SupportsBlockAccess() {
+  return true;
+}
+
+bool PSArc::LooseFileSource::SupportsConcurrentReads() {
+  return true;
+}
+
 PSArc::File::File(std::string name, std::vector<byte> data) : path(name) {
-  this->uncompressedBytes.emplace();
-  FileData& fileData = this->uncompressedBytes.value();
+  SetPathStrings();
+
+  std::shared_ptr<FileData> fileData = std::make_shared<FileData>();
+
+  fileData->uncompressedMaxBlockSize = 65536;
+  fileData->uncompressedTotalSize    = data.size();
+  fileData->compressedMaxBlockSize   = 65536;
+  fileData->bytes                    = std::move(data);
+
+  this->uncompressedBytes.owned = std::move(fileData);
+}
+
+PSArc::File::File(std::string name, FileSourceProvider* provider) : source(provider), path(name) {
+  SetPathStrings();
+
+  this->compressedSource =
+    (provider != nullptr && provider->GetCompressionType() != CompressionType::PSARC_COMPRESSION_TYPE_NONE) ? true : false;
+}
+
+PSArc::File::File(std::string name, std::shared_ptr<FileSourceProvider> provider) : File(std::move(name), provider.get()) {
+  this->ownedSource = std::move(provider);
+}
+
+std::shared_ptr<PSArc::FileData> PSArc::File::GetState(const CachedFileData& state) const {
+  if (state.owned != nullptr)
+    return state.owned;
+
+  // Data that was evicted while a caller still held it is handed back to the cache.
+  std::shared_ptr<FileData> data = state.cached.lock();
+  if (data != nullptr && this->cache != nullptr)
+    this->cache->Insert(data);
+
+  return data;
+}
+
+std::shared_ptr<PSArc::FileData> PSArc::File::PeekState(const CachedFileData& state) const noexcept {
+  if (state.owned != nullptr)
+    return state.owned;
+
+  return state.cached.lock();
+}
+
+void PSArc::File::SetState(CachedFileData& state, std::shared_ptr<FileData> data, bool reloadable) {
+  ClearState(state);
+
+  if (reloadable && this->cache != nullptr) {
+    state.cached = data;
+    this->cache->Insert(std::move(data));
+  }
+  else {
+    state.owned = std::move(data);
+  }
+}
+
+void PSArc::File::ClearState(CachedFileData& state) {
+  if (this->cache != nullptr) {
+    std::shared_ptr<FileData> cached = state.cached.lock();
+    if (cached != nullptr)
+      this->cache->Erase(cached.get());
+  }
+
+  state.owned.reset();
+  state.cached.reset();
+}
+
+void PSArc::File::SetCache(std::shared_ptr<FileCache> fileCache) {
+  std::shared_ptr<FileData> uncompressedData = GetState(this->uncompressedBytes);
+  std::shared_ptr<FileData> compressedData   = GetState(this->compressedBytes);
+
+  ClearState(this->uncompressedBytes);
+  ClearState(this->compressedBytes);
+
+  this->cache = std::move(fileCache);
+
+  if (uncompressedData != nullptr)
+    SetState(this->uncompressedBytes, std::move(uncompressedData), this->source != nullptr);
+  if (compressedData != nullptr)
+    SetState(this->compressedBytes, std::move(compressedData), this->source != nullptr && this->compressedSource);
+}
+
+std::shared_ptr<PSArc::FileData> PSArc::File::AcquireCompressedState(CompressionType preferredType) {
+  std::shared_ptr<FileData> compressedData = GetState(this->compressedBytes);
+  if (compressedData != nullptr)
+    return compressedData;
+
+  if (this->source != nullptr && this->compressedSource) {
+    compressedData = std::make_shared<FileData>(this->source->GetData());
+    SetState(this->compressedBytes, compressedData, true);
+    return compressedData;
+  }
+
+  if (preferredType == CompressionType::PSARC_COMPRESSION_TYPE_NONE)
+    return nullptr;
+
+  std::shared_ptr<FileData> uncompressedData = AcquireUncompressedState();
+  if (uncompressedData == nullptr)
+    return nullptr;
+
+  return CompressState(*uncompressedData, preferredType, uncompressedData->uncompressedMaxBlockSize);
+}
+
+std::shared_ptr<PSArc::FileData> PSArc::File::AcquireUncompressedState() {
+  std::shared_ptr<FileData> uncompressedData = GetState(this->uncompressedBytes);
+  if (uncompressedData != nullptr)
+    return uncompressedData;
+
+  if (this->source != nullptr && !this->compressedSource) {
+    uncompressedData = std::make_shared<FileData>(this->source->GetData());
+    SetState(this->uncompressedBytes, uncompressedData, true);
+    return uncompressedData;
+  }
+
+  std::shared_ptr<FileData> compressedData = GetState(this->compressedBytes);
+  if (compressedData == nullptr && this->source != nullptr)
+    compressedData = AcquireCompressedState();
+
+  if (compressedData == nullptr)
+    return nullptr;
+
+  return DecompressState(*compressedData);
+}
+
+std::shared_ptr<PSArc::FileData> PSArc::File::AcquireWholeSourceState() {
+  if (this->source == nullptr || this->source->SupportsBlockAccess())
+    return nullptr;
+
+  return this->compressedSource ? AcquireCompressedState() : AcquireUncompressedState();
+}
+
+std::shared_ptr<PSArc::FileData> PSArc::File::CompressState(
+  const FileData& uncompressedData, CompressionType type, size_t blockSize, BlockCompressionCache* blockCache) {
+  std::shared_ptr<FileData> toCompress = std::make_shared<FileData>();
+  toCompress->compressionType          = type;
+  toCompress->uncompressedMaxBlockSize = blockSize;
+  toCompress->compressedMaxBlockSize   = blockSize;
+
+  uncompressedData.Compress(*toCompress, blockCache);
+
+  // Data compressed with caller chosen settings can not be reloaded from the source.
+  SetState(this->compressedBytes, toCompress, false);
+  return toCompress;
+}
+
+std::shared_ptr<PSArc::FileData> PSArc::File::DecompressState(const FileData& compressedData) {
+  std::shared_ptr<FileData> uncompressedData = std::make_shared<FileData>();
+
+  compressedData.Decompress(*uncompressedData);
+
+  SetState(this->uncompressedBytes, uncompressedData, this->source != nullptr);
+  return uncompressedData;
+}
+
+void PSArc::File::LoadCompressedBytes(CompressionType preferredType) {
+  AcquireCompressedState(preferredType);
+}
+
+void PSArc::File::LoadUncompressedBytes() {
+  AcquireUncompressedState();
+}
+
+std::shared_ptr<const std::vector<byte>> PSArc::File::GetCompressedBytes() {
+  std::shared_ptr<FileData> compressedData = AcquireCompressedState();
+
+  if (compressedData == nullptr) {
+    return std::make_shared<const std::vector<byte>>();
+  }
+
+  // Shares ownership of the cached data instead of copying it, the bytes stay valid even if the cache is cleared or evicted.
+  return std::shared_ptr<const std::vector<byte>>(compressedData, &compressedData->bytes);
+}
+
+std::shared_ptr<const std::vector<byte>> PSArc::File::GetUncompressedBytes() {
+  std::shared_ptr<FileData> uncompressedData = AcquireUncompressedState();
+
+  if (uncompressedData == nullptr) {
+    return std::make_shared<const std::vector<byte>>();
+  }
+
+  return std::shared_ptr<const std::vector<byte>>(uncompressedData, &uncompressedData->bytes);
+}
+
+void PSArc::File::ClearCompressedBytes() {
+  ClearState(this->compressedBytes);
+}
+
+void PSArc::File::ClearUncompressedBytes() {
+  ClearState(this->uncompressedBytes);
+}
+
+void PSArc::File::Compress(CompressionType type, size_t blockSize, BlockCompressionCache* blockCache) {
+  std::shared_ptr<FileData> uncompressedData = GetState(this->uncompressedBytes);
+
+  // An uncompressed source is streamed through the compressor, compressed sources are passed through as is unless they were
+  // decompressed before.
+  if (uncompressedData == nullptr && this->source != nullptr && !this->compressedSource && this->source->SupportsBlockAccess()) {
+    std::shared_ptr<FileData> compressedData = CompressSourceState(type, blockSize, blockCache);
+    if (compressedData != nullptr)
+      SetState(this->compressedBytes, std::move(compressedData), false);
+
+    return;
+  }
+
+  if (uncompressedData == nullptr && this->source != nullptr && !this->compressedSource)
+    uncompressedData = AcquireWholeSourceState();
+
+  if (uncompressedData == nullptr) {
+    return;
+  }
+
+  CompressState(*uncompressedData, type, blockSize, blockCache);
+}
+
+size_t PSArc::File::GetCompressedBlockCount(size_t blockSize) {
+  std::shared_ptr<FileData> uncompressedData = GetState(this->uncompressedBytes);
+
+  // Follows the cases of Compress.
+  if (uncompressedData == nullptr && this->source != nullptr && !this->compressedSource)
+    return PSArc::GetBlockCount(this->source->GetUncompressedSize(), blockSize);
+
+  if (uncompressedData == nullptr)
+    return GetBlockCount();
+
+  return PSArc::GetBlockCount(uncompressedData->uncompressedTotalSize, blockSize);
+}
+
+bool PSArc::File::CanCompressBlockRanges() const noexcept {
+  // States of a file without a source are always owned, hence they can not be evicted while the ranges are compressed.
+  if (this->source == nullptr)
+    return this->uncompressedBytes.owned != nullptr;
+
+  return !this->compressedSource && this->source->SupportsBlockAccess() && this->source->SupportsConcurrentReads();
+}
+
+bool PSArc::File::CompressBlockRange(
+  CompressionType type, size_t blockSize, size_t firstBlock, size_t blockCount, FileData& dst, BlockCompressionCache* blockCache) {
+  std::shared_ptr<FileData> uncompressedData = GetState(this->uncompressedBytes);
+
+  if (blockSize == 0 || (uncompressedData == nullptr && (this->source == nullptr || this->compressedSource)))
+    return false;
+
+  const size_t totalSize  = (uncompressedData != nullptr) ? uncompressedData->uncompressedTotalSize : this->source->GetUncompressedSize();
+  const size_t rangeStart = firstBlock * blockSize;
+  const size_t rangeEnd   = std::min(totalSize, (firstBlock + blockCount) * blockSize);
+
+  if (rangeStart >= rangeEnd)
+    return false;
+
+  FileData chunk;
+  chunk.uncompressedMaxBlockSize = blockSize;
+  chunk.bytes                    = BufferPool::Get().Acquire(rangeEnd - rangeStart);
+
+  if (uncompressedData != nullptr) {
+    if (rangeEnd > uncompressedData->bytes.size())
+      return false;
+
+    chunk.bytes.assign(uncompressedData->bytes.begin() + rangeStart, uncompressedData->bytes.begin() + rangeEnd);
+  }
+  else {
+    // The block size of the source does not have to match, hence all source blocks overlapping the range are read.
+    const size_t sourceBlockSize = this->source->GetMaxBlockSize();
+    if (sourceBlockSize == 0)
+      return false;
+
+    const size_t sourceFirstBlock = rangeStart / sourceBlockSize;
+    const size_t sourceBlockCount = (rangeEnd + sourceBlockSize - 1) / sourceBlockSize - sourceFirstBlock;
+    const size_t sourceStart      = sourceFirstBlock * sourceBlockSize;
+    const size_t sourceEnd        = std::min(totalSize, (sourceFirstBlock + sourceBlockCount) * sourceBlockSize);
+
+    std::vector<byte>& pending = GetScratchBuffer(PSARC_SCRATCH_BUFFER_PENDING);
+    pending.resize(sourceEnd - sourceStart);
+
+    if (!DecompressSourceInto(pending, sourceFirstBlock, sourceBlockCount)) {
+      std::cout << "Fatal Error in compression: Failed to read blocks " << firstBlock << " to " << firstBlock + blockCount - 1 << " of "
+                << GetPathString() << "." << std::endl;
+      return false;
+    }
+
+    chunk.bytes.assign(pending.begin() + (rangeStart - sourceStart), pending.begin() + (rangeEnd - sourceStart));
+  }
+
+  dst.compressionType          = type;
+  dst.uncompressedMaxBlockSize = blockSize;
+  dst.compressedMaxBlockSize   = blockSize;
+
+  chunk.Compress(dst, blockCache);
+  return true;
+}
+
+void PSArc::File::SetCompressedBlockRanges(const std::vector<FileData>& ranges, CompressionType type, size_t blockSize) {
+  std::shared_ptr<FileData> compressedData = std::make_shared<FileData>();
+  compressedData->compressionType          = type;
+  compressedData->uncompressedMaxBlockSize = blockSize;
+  compressedData->compressedMaxBlockSize   = blockSize;
+
+  size_t compressedTotalSize = 0;
+  for (const FileData& range : ranges) {
+    compressedTotalSize += range.bytes.size();
+  }
+
+  compressedData->bytes = BufferPool::Get().Acquire(compressedTotalSize);
+
+  for (const FileData& range : ranges) {
+    compressedData->bytes.insert(compressedData->bytes.end(), range.bytes.begin(), range.bytes.end());
+    compressedData->blocks.insert(compressedData->blocks.end(), range.blocks.begin(), range.blocks.end());
+    compressedData->uncompressedTotalSize += range.uncompressedTotalSize;
+  }
+
+  // Like CompressState, data compressed with caller chosen settings can not be reloaded from the source.
+  SetState(this->compressedBytes, std::move(compressedData), false);
+}
+
+std::shared_ptr<PSArc::FileData> PSArc::File::CompressSourceState(
+  CompressionType type, size_t blockSize, BlockCompressionCache* blockCache) {
+  std::shared_ptr<FileData> compressedData = std::make_shared<FileData>();
+  compressedData->compressionType          = type;
+  compressedData->uncompressedMaxBlockSize = blockSize;
+  compressedData->compressedMaxBlockSize   = blockSize;
+
+  const size_t sourceBlockCount = this->source->GetBlockCount();
+
+  if (this->source->HasUncompressedSize())
+    compressedData->bytes = BufferPool::Get().Acquire(this->source->GetUncompressedSize());
+
+  // The block size of the source does not have to match, hence source blocks are collected until whole blocks can be compressed.
+  std::vector<byte>& pending = GetScratchBuffer(PSARC_SCRATCH_BUFFER_PENDING);
+  std::vector<byte>& stored  = GetScratchBuffer(PSARC_SCRATCH_BUFFER_STORED_BLOCK);
+  size_t uncompressedTotalSize = 0;
+
+  // The chunks are reused for every batch of blocks, their buffers go back to the pool afterwards.
+  FileData chunk;
+  chunk.uncompressedMaxBlockSize = blockSize;
+
+  FileData compressedChunk;
+  compressedChunk.compressionType          = type;
+  compressedChunk.uncompressedMaxBlockSize = blockSize;
+  compressedChunk.compressedMaxBlockSize   = blockSize;
+
+  pending.clear();
+
+  for (size_t i = 0; i < sourceBlockCount; i++) {
+    const BlockDescriptor sourceBlock = this->source->GetBlockDescriptor(i);
+
+    stored.resize(sourceBlock.compressedSize);
+    if (sourceBlock.isCompressed || !this->source->ReadBlock(i, stored)) {
+      std::cout << "Fatal Error in compression: Failed to read block " << i << " of " << GetPathString() << "." << std::endl;
+      return nullptr;
+    }
+
+    pending.insert(pending.end(), stored.begin(), stored.end());
+
+    const bool lastBlock = (i + 1 == sourceBlockCount);
+    const size_t ready   = lastBlock ? pending.size() : (pending.size() / blockSize) * blockSize;
+
+    if (ready == 0)
+      continue;
+
+    chunk.bytes.assign(pending.begin(), pending.begin() + ready);
+    pending.erase(pending.begin(), pending.begin() + ready);
+
+    chunk.Compress(compressedChunk, blockCache);
+
+    compressedData->bytes.insert(compressedData->bytes.end(), compressedChunk.bytes.begin(), compressedChunk.bytes.end());
+    compressedData->blocks.insert(compressedData->blocks.end(), compressedChunk.blocks.begin(), compressedChunk.blocks.end());
+    uncompressedTotalSize += ready;
+  }
+
+  compressedData->uncompressedTotalSize = uncompressedTotalSize;
+  return compressedData;
+}
+
+bool PSArc::File::DecompressSourceInto(std::span<byte> dst, size_t firstBlock, size_t blockCount) {
+  if (std::shared_ptr<FileData> sourceData = AcquireWholeSourceState())
+    return sourceData->DecompressInto(dst, firstBlock, blockCount);
+
+  const size_t totalBlockCount = this->source->GetBlockCount();
+  const size_t maxBlockSize    = this->source->GetMaxBlockSize();
+  const size_t totalSize       = this->source->GetUncompressedSize();
+
+  if (firstBlock > totalBlockCount || blockCount > totalBlockCount - firstBlock)
+    return false;
+
+  const size_t rangeStart = firstBlock * maxBlockSize;
+  const size_t rangeEnd   = std::min(totalSize, (firstBlock + blockCount) * maxBlockSize);
+
+  if (dst.size() != rangeEnd - rangeStart)
+    return false;
+
+  const CompressionType type = this->source->GetCompressionType();
+  std::vector<byte>& stored  = GetScratchBuffer(PSARC_SCRATCH_BUFFER_STORED_BLOCK);
+  size_t outputOffset        = 0;
+
+  for (size_t i = firstBlock; i < firstBlock + blockCount; i++) {
+    const BlockDescriptor block = this->source->GetBlockDescriptor(i);
+    const size_t outputSize     = GetUncompressedBlockSize(i, totalSize, maxBlockSize);
+
+    stored.resize(block.compressedSize);
+    if (!this->source->ReadBlock(i, stored) || !decompressBlock(type, block, dst.subspan(outputOffset, outputSize), stored))
+      return false;
+
+    outputOffset += outputSize;
+  }
+
+  return true;
+}
+
+void PSArc::File::Decompress() {
+  std::shared_ptr<FileData> compressedData = GetState(this->compressedBytes);
+  if (compressedData == nullptr) {
+    return;
+  }
+
+  DecompressState(*compressedData);
+}
+
+bool PSArc::File::DecompressInto(std::span<byte> dst) {
+  if (std::shared_ptr<FileData> uncompressedData = GetState(this->uncompressedBytes))
+    return uncompressedData->DecompressInto(dst, 0, uncompressedData->GetBlockCount());
+
+  if (std::shared_ptr<FileData> compressedData = GetState(this->compressedBytes))
+    return compressedData->DecompressInto(dst, 0, compressedData->GetBlockCount());
+
+  if (this->source == nullptr)
+    return dst.empty();
+
+  // Neither state is cached, stream the blocks from the source without keeping the data around.
+  return DecompressSourceInto(dst, 0, this->source->GetBlockCount());
+}
+
+bool PSArc::File::DecompressInto(std::span<byte> dst, size_t firstBlock, size_t blockCount) {
+  // Block indices refer to the compressed layout whenever there is one.
+  if (std::shared_ptr<FileData> compressedData = GetState(this->compressedBytes))
+    return compressedData->DecompressInto(dst, firstBlock, blockCount);
+
+  if (this->source != nullptr && this->compressedSource)
+    return DecompressSourceInto(dst, firstBlock, blockCount);
+
+  if (std::shared_ptr<FileData> uncompressedData = GetState(this->uncompressedBytes))
+    return uncompressedData->DecompressInto(dst, firstBlock, blockCount);
+
+  if (this->source != nullptr)
+    return DecompressSourceInto(dst, firstBlock, blockCount);
+
+  return false;
+}
+
+size_t PSArc::File::GetBlockCount() {
+  if (std::shared_ptr<FileData> compressedData = GetState(this->compressedBytes))
+    return compressedData->GetBlockCount();
+
+  if (std::shared_ptr<FileData> sourceData = AcquireWholeSourceState())
+    return sourceData->GetBlockCount();
+
+  if (this->source != nullptr && this->compressedSource)
+    return this->source->GetBlockCount();
+
+  if (std::shared_ptr<FileData> uncompressedData = GetState(this->uncompressedBytes))
+    return uncompressedData->GetBlockCount();
+
+  if (this->source != nullptr)
+    return this->source->GetBlockCount();
+
+  return 0;
+}
+
+size_t PSArc::File::GetMaxBlockSize() {
+  if (std::shared_ptr<FileData> compressedData = GetState(this->compressedBytes))
+    return compressedData->uncompressedMaxBlockSize;
+
+  if (std::shared_ptr<FileData> sourceData = AcquireWholeSourceState())
+    return sourceData->uncompressedMaxBlockSize;
+
+  if (this->source != nullptr && this->compressedSource)
+    return this->source->GetMaxBlockSize();
+
+  if (std::shared_ptr<FileData> uncompressedData = GetState(this->uncompressedBytes))
+    return uncompressedData->uncompressedMaxBlockSize;
+
+  if (this->source != nullptr)
+    return this->source->GetMaxBlockSize();
+
+  return 0;
+}
+
+bool PSArc::File::ReadCompressedBlock(size_t index, size_t offset, std::span<byte> dst) {
+  std::shared_ptr<FileData> compressedData = GetState(this->compressedBytes);
+
+  // A compressed source without block access is sliced like the compressed state.
+  if (compressedData == nullptr && this->compressedSource)
+    compressedData = AcquireWholeSourceState();
+
+  if (compressedData != nullptr) {
+    if (index >= compressedData->blocks.size() || dst.size() != compressedData->blocks[index].compressedSize)
+      return false;
+
+    if (offset + dst.size() > compressedData->bytes.size())
+      return false;
+
+    std::memcpy(dst.data(), compressedData->bytes.data() + offset, dst.size());
+    return true;
+  }
+
+  if (this->source != nullptr && this->compressedSource)
+    return this->source->ReadBlock(index, dst);
+
+  return false;
+}
+
+/* Splits a '/' separated path into its directory part and its last component, trailing separators are ignored. */
+static void splitFilePath(std::string_view path, std::string_view& directory, std::string_view& name) {
+  while (!path.empty() && path.back() == '/') {
+    path.remove_suffix(1);
+  }
+
+  const size_t separator = path.rfind('/');
+  directory              = (separator == std::string_view::npos) ? std::string_view() : path.substr(0, separator);
+  name                   = (separator == std::string_view::npos) ? path : path.substr(separator + 1);
+}
+
+/* Drops trailing separators from the stored path of file, which is linked into the tree by the component before them. */
+static void trimTrailingSeparators(PSArc::File& file) {
+  // The path as it was given, including a leading '/'.
+  const std::string_view path = file.GetPathView(PSArc::PSARC_PATH_TYPE_IGNORECASE);
+
+  if (path.ends_with('/'))
+    file.SetPath(std::string(path.substr(0, path.find_last_not_of('/') + 1)));
+}
+
+/* Removes the next non empty component from path and returns it, an empty result means there are no components left. */
+static std::string_view nextPathComponent(std::string_view& path) {
+  while (!path.empty() && path.front() == '/') {
+    path.remove_prefix(1);
+  }
+
+  const std::string_view component = path.substr(0, path.find('/'));
+  path.remove_prefix(component.size());
+  return component;
+}
+
+/* Joins the non empty components of path with single separators, the result has no leading or trailing separators. */
+static std::string joinPathComponents(std::string_view path) {
+  std::string joined;
+  joined.reserve(path.size());
+
+  for (std::string_view component = nextPathComponent(path); !component.empty(); component = nextPathComponent(path)) {
+    if (!joined.empty())
+      joined.push_back('/');
+
+    joined.append(component);
+  }
+
+  return joined;
+}
+
+PSArc::Directory& PSArc::Archive::GetOrAddDirectory(std::string_view directory) {
+  Directory* current = std::addressof(this->rootDirectory);
+
+  for (std::string_view component = nextPathComponent(directory); !component.empty(); component = nextPathComponent(directory)) {
+    Directory* next = current->FindSubDirectory(component);
+
+    if (next == nullptr) {
+      next = this->directoryArena.Create(std::string(component));
+      current->LinkSubDirectory(next);
+    }
+
+    current = next;
+  }
+
+  return *current;
+}
+
+PSArc::Directory* PSArc::Archive::FindDirectory(std::string_view directory) {
+  Directory* current = std::addressof(this->rootDirectory);
+
+  for (std::string_view component = nextPathComponent(directory); !component.empty() && current != nullptr;
+       component                  = nextPathComponent(directory)) {
+    current = current->FindSubDirectory(component);
+  }
+
+  return current;
+}
+
+bool PSArc::Archive::InsertFile(Directory& directory, std::string_view fileName, File&& file) {
+  if (File* existing = directory.FindFile(fileName)) {
+    *existing = std::move(file);
+    return false;
+  }
+
+  // The name may point into file, hence the key is created before the file is moved. A replaced file keeps its path.
+  AddCaseFoldedPath(file.GetPathView(PSARC_PATH_TYPE_RELATIVE));
+  std::string key(fileName);
+  directory.LinkFile(std::move(key), this->fileArena.Create(std::move(file)));
+  return true;
+}
+
+size_t PSArc::Archive::DestroyChildren(Directory& directory) {
+  size_t destroyedFiles = 0;
+
+  for (File* file : directory.files) {
+    if (file != nullptr) {
+      RemoveCaseFoldedPath(file->GetPathView(PSARC_PATH_TYPE_RELATIVE));
+      this->fileArena.Destroy(file);
+      destroyedFiles++;
+    }
+  }
+
+  for (Directory* subDirectory : directory.subDirectories) {
+    if (subDirectory != nullptr) {
+      destroyedFiles += DestroyChildren(*subDirectory);
+      this->directoryArena.Destroy(subDirectory);
+    }
+  }
 
-  fileData.bytes                    = data;
-  fileData.uncompressedMaxBlockSize = 65536;
-  fileData.uncompressedTotalSize    = data.size();
-  fileData.compressedMaxBlockSize   = 65536;
+  directory.files.clear();
+  directory.subDirectories.clear();
+  directory.fileIndices.clear();
+  directory.subDirectoryIndices.clear();
+  return destroyedFiles;
 }
 
-PSArc::File::File(std::string name, FileSourceProvider* provider) : source(provider), path(name) {
-  this->compressedSource =
-    (provider != nullptr && provider->GetCompressionType() != CompressionType::PSARC_COMPRESSION_TYPE_NONE) ? true : false;
-}
+void PSArc::Archive::CopyChildren(const Directory& source, Directory& target) {
+  for (const File* file : source.files) {
+    if (file == nullptr)
+      continue;
 
-void PSArc::File::LoadCompressedBytes(CompressionType preferredType) {
-  if (this->compressedBytes.has_value())
-    return;
+    std::string_view directory;
+    std::string_view name;
+    splitFilePath(file->GetPathView(PSARC_PATH_TYPE_RELATIVE), directory, name);
+    target.LinkFile(std::string(name), this->fileArena.Create(*file));
+  }
 
-  if (this->source != nullptr) {
-    if (this->compressedSource) {
-      this->compressedBytes = this->source->GetData();
-      return;
-    }
-    else if (preferredType != CompressionType::PSARC_COMPRESSION_TYPE_NONE) {
-      LoadUncompressedBytes();
-    }
+  for (const Directory* subDirectory : source.subDirectories) {
+    if (subDirectory == nullptr)
+      continue;
+
+    Directory* copy = this->directoryArena.Create(subDirectory->name);
+    target.LinkSubDirectory(copy);
+    CopyChildren(*subDirectory, *copy);
   }
+}
 
-  if (this->uncompressedBytes.has_value() && preferredType != CompressionType::PSARC_COMPRESSION_TYPE_NONE) {
-    Compress(preferredType, this->uncompressedBytes.value().uncompressedMaxBlockSize);
-    return;
+PSArc::Archive::Archive(const Archive& other)
+    : rootDirectory("root"),
+      manifest(other.manifest),
+      cache(other.cache),
+      fileCount(other.fileCount) {
+  CopyChildren(other.rootDirectory, this->rootDirectory);
+}
+
+PSArc::Archive::Archive(Archive&& other)
+    : rootDirectory(std::move(other.rootDirectory)),
+      directoryArena(std::move(other.directoryArena)),
+      fileArena(std::move(other.fileArena)),
+      manifest(std::move(other.manifest)),
+      cache(std::move(other.cache)),
+      fileCount(std::exchange(other.fileCount, 0)) {
+  other.indices.Reset();
+}
+
+PSArc::Archive& PSArc::Archive::operator=(const Archive& other) {
+  if (this != &other)
+    *this = Archive(other);
+
+  return *this;
+}
+
+PSArc::Archive& PSArc::Archive::operator=(Archive&& other) {
+  if (this == &other)
+    return *this;
+
+  this->indices.Reset();
+  DestroyChildren(this->rootDirectory);
+
+  this->rootDirectory  = std::move(other.rootDirectory);
+  this->directoryArena = std::move(other.directoryArena);
+  this->fileArena      = std::move(other.fileArena);
+  this->manifest       = std::move(other.manifest);
+  this->cache          = std::move(other.cache);
+  this->fileCount      = std::exchange(other.fileCount, 0);
+  other.indices.Reset();
+  return *this;
+}
+
+PSArc::Archive::~Archive() {
+  // Nothing has to be kept in sync while all files are destroyed.
+  this->indices.Reset();
+  DestroyChildren(this->rootDirectory);
+}
+
+bool PSArc::Archive::AddFile(File file) {
+  if (this->cache != nullptr)
+    file.SetCache(this->cache);
+
+  this->indices.Invalidate();
+  trimTrailingSeparators(file);
+
+  if (file.IsManifest()) {
+    this->manifest.emplace(std::move(file));
+    return true;
   }
+
+  std::string_view directory;
+  std::string_view name;
+  splitFilePath(file.GetPathView(PSARC_PATH_TYPE_RELATIVE), directory, name);
+
+  if (name.empty())
+    return false;
+
+  if (InsertFile(GetOrAddDirectory(directory), name, std::move(file)))
+    this->fileCount++;
+
+  return true;
 }
 
-void PSArc::File::LoadUncompressedBytes() {
-  if (this->uncompressedBytes.has_value())
-    return;
+bool PSArc::Archive::AddFiles(std::vector<File> files) {
+  this->indices.Invalidate();
 
-  if (this->source != nullptr) {
-    if (this->compressedSource) {
-      LoadCompressedBytes();
-      Decompress();
-      return;
+  struct Entry {
+    std::string_view directory;
+    std::string_view name;
+    size_t index;
+  };
+
+  std::vector<Entry> entries;
+  entries.reserve(files.size());
+
+  bool allInserted = true;
+
+  for (size_t i = 0; i < files.size(); i++) {
+    if (this->cache != nullptr)
+      files[i].SetCache(this->cache);
+
+    trimTrailingSeparators(files[i]);
+
+    if (files[i].IsManifest()) {
+      this->manifest.emplace(std::move(files[i]));
+      continue;
     }
-    else {
-      this->uncompressedBytes = this->source->GetData();
-      return;
+
+    Entry entry = {{}, {}, i};
+    splitFilePath(files[i].GetPathView(PSARC_PATH_TYPE_RELATIVE), entry.directory, entry.name);
+
+    if (entry.name.empty()) {
+      allInserted = false;
+      continue;
     }
+
+    entries.push_back(entry);
   }
 
-  if (this->compressedBytes.has_value()) {
-    Decompress();
-    return;
+  // Grouping the files by directory resolves every directory once and allows reserving the exact space for its files.
+  // The sort is stable, hence several files with the same path stay in their original order.
+  std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+    if (a.directory != b.directory)
+      return a.directory < b.directory;
+
+    return a.name < b.name;
+  });
+
+  for (size_t groupStart = 0; groupStart < entries.size();) {
+    size_t groupEnd = groupStart + 1;
+    while (groupEnd < entries.size() && entries[groupEnd].directory == entries[groupStart].directory) {
+      groupEnd++;
+    }
+
+    Directory& directory = GetOrAddDirectory(entries[groupStart].directory);
+    directory.files.reserve(directory.files.size() + (groupEnd - groupStart));
+    directory.fileIndices.reserve(directory.fileIndices.size() + (groupEnd - groupStart));
+
+    for (size_t i = groupStart; i < groupEnd; i++) {
+      // Of several files with the same path only the last one is kept.
+      if (i + 1 < groupEnd && entries[i + 1].name == entries[i].name)
+        continue;
+
+      if (InsertFile(directory, entries[i].name, std::move(files[entries[i].index])))
+        this->fileCount++;
+    }
+
+    groupStart = groupEnd;
   }
+
+  return allInserted;
 }
 
-const std::shared_ptr<std::vector<byte>> PSArc::File::GetCompressedBytes() {
-  if (!this->compressedBytes.has_value()) {
-    LoadCompressedBytes();
-  }
+void PSArc::Archive::StageFile(File file) {
+  const size_t shard = std::hash<std::thread::id> {}(std::this_thread::get_id()) % StagedFiles::SHARD_COUNT;
 
-  return std::make_shared<std::vector<byte>>(this->compressedBytes.value_or(FileData()).bytes);
+  std::lock_guard<std::mutex> lock(this->stagedFiles.shards[shard].mutex);
+  this->stagedFiles.shards[shard].files.push_back(std::move(file));
 }
 
-const std::shared_ptr<std::vector<byte>> PSArc::File::GetUncompressedBytes() {
-  if (!this->uncompressedBytes.has_value()) {
-    LoadUncompressedBytes();
+bool PSArc::Archive::CommitStagedFiles() {
+  size_t stagedCount = 0;
+  for (StagedFiles::Shard& shard : this->stagedFiles.shards) {
+    stagedCount += shard.files.size();
   }
 
-  return std::make_shared<std::vector<byte>>(this->uncompressedBytes.value_or(FileData()).bytes);
-}
+  std::vector<File> files;
+  files.reserve(stagedCount);
 
-void PSArc::File::ClearCompressedBytes() {
-  if (this->compressedBytes.has_value()) {
-    this->compressedBytes.reset();
+  for (StagedFiles::Shard& shard : this->stagedFiles.shards) {
+    std::move(shard.files.begin(), shard.files.end(), std::back_inserter(files));
+    shard.files.clear();
+    shard.files.shrink_to_fit();
   }
+
+  return AddFiles(std::move(files));
 }
 
-void PSArc::File::ClearUncompressedBytes() {
-  if (this->uncompressedBytes.has_value()) {
-    this->uncompressedBytes.reset();
+PSArc::File* PSArc::Archive::FindFile(const std::string& name, PathType pathType) {
+  if (name == "PSArcManifest.bin") {
+    if (!this->manifest.has_value())
+      return nullptr;
+
+    return &this->manifest.value();
   }
+
+  if (pathType == PSARC_PATH_TYPE_IGNORECASE)
+    return FindFileIgnoreCase(name);
+
+  // Files are looked up by name in their directory, hence the lookup is not sensitive to whether the caller supplied a leading '/'
+  // or not.
+  std::string_view directoryPath;
+  std::string_view fileName;
+  splitFilePath(name, directoryPath, fileName);
+
+  Directory* directory = FindDirectory(directoryPath);
+  if (directory == nullptr || fileName.empty())
+    return nullptr;
+
+  return directory->FindFile(fileName);
 }
 
-void PSArc::File::Compress(CompressionType type, size_t blockSize) {
-  if (!this->uncompressedBytes.has_value()) {
-    return;
+bool PSArc::Archive::RemoveFile(const std::string& path) {
+  if (path == "PSArcManifest.bin" || path == "/PSArcManifest.bin") {
+    if (!this->manifest.has_value())
+      return false;
+
+    RemoveManifestFile();
+    return true;
   }
 
-  FileData toCompress;
-  toCompress.compressionType          = type;
-  toCompress.uncompressedMaxBlockSize = blockSize;
-  toCompress.compressedMaxBlockSize   = blockSize;
+  std::string_view directoryPath;
+  std::string_view fileName;
+  splitFilePath(path, directoryPath, fileName);
 
-  this->compressedBytes.emplace(toCompress);
+  Directory* directory = FindDirectory(directoryPath);
+  if (directory == nullptr || fileName.empty())
+    return false;
 
-  this->uncompressedBytes.value().Compress(this->compressedBytes.value());
+  File* file = directory->UnlinkFile(fileName);
+  if (file == nullptr)
+    return false;
+
+  RemoveCaseFoldedPath(file->GetPathView(PSARC_PATH_TYPE_RELATIVE));
+  this->fileArena.Destroy(file);
+  this->fileCount--;
+  this->indices.Invalidate();
+  return true;
 }
 
-void PSArc::File::Decompress() {
-  if (!this->compressedBytes.has_value()) {
-    return;
+bool PSArc::Archive::RemoveDirectory(const std::string& path) {
+  std::string_view parentPath;
+  std::string_view directoryName;
+  splitFilePath(path, parentPath, directoryName);
+
+  Directory* parent = FindDirectory(parentPath);
+  if (parent == nullptr || directoryName.empty())
+    return false;
+
+  Directory* directory = parent->UnlinkSubDirectory(directoryName);
+  if (directory == nullptr)
+    return false;
+
+  this->fileCount -= DestroyChildren(*directory);
+  this->directoryArena.Destroy(directory);
+  this->indices.Invalidate();
+  return true;
+}
+
+void PSArc::Archive::SetPathsFromTree(Directory& directory, std::string& directoryPath) {
+  const size_t directoryPathSize = directoryPath.size();
+
+  for (File* file : directory.files) {
+    if (file == nullptr)
+      continue;
+
+    std::string_view parentPath;
+    std::string_view name;
+    splitFilePath(file->GetPathView(PSARC_PATH_TYPE_RELATIVE), parentPath, name);
+
+    RemoveCaseFoldedPath(file->GetPathView(PSARC_PATH_TYPE_RELATIVE));
+    file->SetPath(directoryPath + "/" + std::string(name));
+    AddCaseFoldedPath(file->GetPathView(PSARC_PATH_TYPE_RELATIVE));
   }
 
-  FileData uncompressedData;
-  this->uncompressedBytes.emplace(uncompressedData);
+  for (Directory* subDirectory : directory.subDirectories) {
+    if (subDirectory == nullptr)
+      continue;
 
-  this->compressedBytes.value().Decompress(this->uncompressedBytes.value());
+    directoryPath.append("/").append(subDirectory->name);
+    SetPathsFromTree(*subDirectory, directoryPath);
+    directoryPath.resize(directoryPathSize);
+  }
 }
 
-bool PSArc::Archive::AddFile(File file) {
-  if (file.IsManifest()) {
-    this->manifest.emplace(file);
-    return true;
+bool PSArc::Archive::Rename(const std::string& oldPath, const std::string& newPath) {
+  // Like the tree and the stored paths, the paths are compared without empty components.
+  const std::string oldRelativePath = joinPathComponents(oldPath);
+  const std::string newRelativePath = joinPathComponents(newPath);
+
+  std::string_view oldParentPath;
+  std::string_view oldName;
+  std::string_view newParentPath;
+  std::string_view newName;
+  splitFilePath(oldRelativePath, oldParentPath, oldName);
+  splitFilePath(newRelativePath, newParentPath, newName);
+
+  Directory* oldParent = FindDirectory(oldParentPath);
+  if (oldParent == nullptr || oldName.empty() || newName.empty())
+    return false;
+
+  // A file and a directory with the same path can not be told apart by their paths, the target must not exist as either.
+  Directory* newParent = FindDirectory(newParentPath);
+  if (newParent != nullptr && (newParent->FindFile(newName) != nullptr || newParent->FindSubDirectory(newName) != nullptr))
+    return false;
+
+  if (File* file = oldParent->FindFile(oldName)) {
+    // A file with the manifest's name would be the manifest, which is not part of the tree.
+    if (newRelativePath == "PSArcManifest.bin")
+      return false;
+
+    Directory& target = GetOrAddDirectory(newParentPath);
+    oldParent->UnlinkFile(oldName);
+    RemoveCaseFoldedPath(file->GetPathView(PSARC_PATH_TYPE_RELATIVE));
+    file->SetPath(newRelativePath);
+    AddCaseFoldedPath(file->GetPathView(PSARC_PATH_TYPE_RELATIVE));
+    target.LinkFile(std::string(newName), file);
+  }
+  else if (Directory* directory = oldParent->FindSubDirectory(oldName)) {
+    // A directory can not be moved into itself.
+    if (newRelativePath.starts_with(oldRelativePath) && newRelativePath.size() > oldRelativePath.size()
+        && newRelativePath[oldRelativePath.size()] == '/')
+      return false;
+
+    Directory& target = GetOrAddDirectory(newParentPath);
+    oldParent->UnlinkSubDirectory(oldName);
+    directory->name = std::string(newName);
+    target.LinkSubDirectory(directory);
+
+    std::string directoryPath = newRelativePath;
+    SetPathsFromTree(*directory, directoryPath);
+  }
+  else {
+    return false;
+  }
+
+  this->indices.Invalidate();
+  return true;
+}
+
+/* Folds ASCII letters to lower case, other bytes including UTF-8 sequences are kept as they are. */
+static void foldCase(std::string_view path, std::string& folded) {
+  folded.resize(path.size());
+
+  for (size_t i = 0; i < path.size(); i++) {
+    const char c = path[i];
+    folded[i]    = (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c;
   }
+}
 
-  std::reference_wrapper<Directory> current = std::ref(this->rootDirectory);
+void PSArc::Archive::AddCaseFoldedPath(std::string_view path) {
+  if (!this->indices.caseFoldedPathsValid)
+    return;
 
-  bool parsePath    = true;
-  bool fileInserted = false;
+  std::string folded;
+  foldCase(path, folded);
+  this->indices.caseFoldedPaths.emplace(std::move(folded), std::string(path));
+}
 
-  for (auto it = file.path.begin(); it != file.path.end(); it++) {
-    std::filesystem::path pathElement = (*it);
-    std::string pathElementName       = pathElement.generic_string();
+void PSArc::Archive::RemoveCaseFoldedPath(std::string_view path) {
+  if (!this->indices.caseFoldedPathsValid)
+    return;
 
-    Directory& curr = current.get();
+  thread_local std::string folded;
+  foldCase(path, folded);
 
-    if (pathElementName[0] == '/') {
-      parsePath = true;
+  auto [first, last] = this->indices.caseFoldedPaths.equal_range(std::string_view(folded));
+  for (auto entry = first; entry != last; ++entry) {
+    if (entry->second == path) {
+      this->indices.caseFoldedPaths.erase(entry);
+      return;
     }
-    else if (parsePath) {
-      if (it == --file.path.end()) {
-        // Is File
-        const std::string fileRelPath = file.GetPathString(PSARC_PATH_TYPE_RELATIVE);
-        for (PSArc::File& existing : curr.files) {
-          if (existing.GetPathString(PSARC_PATH_TYPE_RELATIVE) == fileRelPath) {
-            existing     = std::move(file);
-            fileInserted = true;
-            return true;
-          }
-        }
-        curr.files.push_back(std::move(file));
-        this->fileCount++;
-        fileInserted = true;
-        break;
-      }
-      else {
-        // Is Directory
-        bool dirFound = false;
-        for (PSArc::Directory& dir : curr.subDirectories) {
-          if (dir.name == pathElementName) {
-            current  = std::ref(dir);
-            dirFound = true;
-            break;
-          }
-        }
+  }
+}
 
-        if (!dirFound) {
-          Directory newDir(pathElementName);
-          curr.subDirectories.push_back(newDir);
-          current = std::ref(curr.subDirectories.back());
-        }
-      }
+PSArc::File* PSArc::Archive::FindFileIgnoreCase(std::string_view name) {
+  if (!this->indices.caseFoldedPathsValid) {
+    this->indices.caseFoldedPaths.reserve(this->fileCount);
+    this->indices.caseFoldedPathsValid = true;
+
+    for (File* file : GetFiles()) {
+      if (!file->IsManifest())
+        AddCaseFoldedPath(file->GetPathView(PSARC_PATH_TYPE_RELATIVE));
     }
   }
 
-  return fileInserted;
+  while (!name.empty() && name.front() == '/') {
+    name.remove_prefix(1);
+  }
+
+  // The manifest is not part of the tree, it is matched by its name.
+  File* manifestFile = this->manifest.has_value() ? &this->manifest.value() : nullptr;
+  if (manifestFile != nullptr && name == "PSArcManifest.bin")
+    return manifestFile;
+
+  thread_local std::string folded;
+  foldCase(name, folded);
+
+  // Of several paths that only differ in case the exact match is preferred.
+  std::string_view match;
+  auto [first, last] = this->indices.caseFoldedPaths.equal_range(std::string_view(folded));
+  for (auto entry = first; entry != last; ++entry) {
+    if (match.empty() || entry->second == name)
+      match = entry->second;
+  }
+
+  if (match.empty())
+    return (manifestFile != nullptr && folded == "psarcmanifest.bin") ? manifestFile : nullptr;
+
+  // The matched path is exact, from here on the lookup costs the same as one with PSARC_PATH_TYPE_RELATIVE.
+  std::string_view directoryPath;
+  std::string_view fileName;
+  splitFilePath(match, directoryPath, fileName);
+
+  Directory* directory = FindDirectory(directoryPath);
+  return (directory != nullptr) ? directory->FindFile(fileName) : nullptr;
 }
 
-PSArc::File* PSArc::Archive::FindFile(const std::string& name, PathType pathType) {
-  if (name == "PSArcManifest.bin") {
-    if (!this->manifest.has_value())
-      return nullptr;
+/* Removes the nullptr entries of unlinked children and moves the remaining positions in indices accordingly. */
+template <typename T>
+static void compactChildren(std::vector<T*>& children, PSArc::PathComponentMap& indices) {
+  std::vector<size_t> newPositions(children.size());
+  size_t count = 0;
 
-    return &this->manifest.value();
+  for (size_t i = 0; i < children.size(); i++) {
+    newPositions[i] = count;
+    if (children[i] != nullptr)
+      children[count++] = children[i];
+  }
+
+  children.resize(count);
+
+  for (auto& entry : indices) {
+    entry.second = newPositions[entry.second];
   }
+}
 
-  std::reference_wrapper<Directory> current = std::ref(this->rootDirectory);
+/* Unlinks the child with the given name. The vector is only compacted once most of its entries are empty, which keeps unlinking O(1). */
+template <typename T>
+static T* unlinkChild(std::vector<T*>& children, PSArc::PathComponentMap& indices, std::string_view childName) {
+  auto entry = indices.find(childName);
+  if (entry == indices.end())
+    return nullptr;
 
-  std::filesystem::path path((name));
+  T* child               = children[entry->second];
+  children[entry->second] = nullptr;
+  indices.erase(entry);
 
-  // Normalize the search name to the same form GetPathString produces for the
-  // given pathType, so the leaf comparison is not sensitive to whether the
-  // caller supplied a leading '/' or not.
-  std::string normalizedName = path.generic_string();
-  switch (pathType) {
-    case PSARC_PATH_TYPE_RELATIVE:
-    case PSARC_PATH_TYPE_IGNORECASE:
-      if (!normalizedName.empty() && normalizedName.front() == '/')
-        normalizedName = normalizedName.substr(1);
-      break;
-    case PSARC_PATH_TYPE_ABSOLUTE:
-      if (!normalizedName.empty() && normalizedName.front() != '/')
-        normalizedName = "/" + normalizedName;
-      break;
-    default:
-      break;
+  if (children.size() > 16 && indices.size() < children.size() / 2)
+    compactChildren(children, indices);
+
+  return child;
+}
+
+PSArc::Directory* PSArc::Directory::FindSubDirectory(std::string_view childName) {
+  auto entry = this->subDirectoryIndices.find(childName);
+  if (entry == this->subDirectoryIndices.end())
+    return nullptr;
+
+  return this->subDirectories[entry->second];
+}
+
+PSArc::File* PSArc::Directory::FindFile(std::string_view fileName) {
+  auto entry = this->fileIndices.find(fileName);
+  if (entry == this->fileIndices.end())
+    return nullptr;
+
+  return this->files[entry->second];
+}
+
+void PSArc::Directory::LinkSubDirectory(Directory* subDirectory) {
+  this->subDirectoryIndices.emplace(subDirectory->name, this->subDirectories.size());
+  this->subDirectories.push_back(subDirectory);
+}
+
+void PSArc::Directory::LinkFile(std::string fileName, File* file) {
+  this->fileIndices.emplace(std::move(fileName), this->files.size());
+  this->files.push_back(file);
+}
+
+PSArc::Directory* PSArc::Directory::UnlinkSubDirectory(std::string_view childName) {
+  return unlinkChild(this->subDirectories, this->subDirectoryIndices, childName);
+}
+
+PSArc::File* PSArc::Directory::UnlinkFile(std::string_view fileName) {
+  return unlinkChild(this->files, this->fileIndices, fileName);
+}
+
+size_t PSArc::Archive::GetFileCount() const noexcept {
+  return this->fileCount;
+}
+
+const PSArc::PathIndex& PSArc::Archive::GetPathIndex() {
+  if (!this->indices.pathIndexValid) {
+    std::vector<std::pair<std::string, File*>> entries;
+    entries.reserve(this->fileCount);
+
+    for (Iterator it = begin(); it != end(); it++) {
+      File* file = *it;
+      if (!file->IsManifest())
+        entries.emplace_back(file->GetPathView(PSARC_PATH_TYPE_RELATIVE), file);
+    }
+
+    this->indices.pathIndex.Build(std::move(entries));
+    this->indices.pathIndexValid = true;
   }
 
-  // If the path starts with "/" (has a root_directory), the first iterator
-  // element is "/" itself — skip it before parsing real components.
-  // If there is no root_directory (truly relative path), start parsing immediately.
-  bool parsePath = path.root_directory().empty();
+  return this->indices.pathIndex;
+}
 
-  for (auto it = path.begin(); it != path.end(); it++) {
-    auto pathElement            = (*it);
-    std::string pathElementName = pathElement.generic_string();
+static void appendDepthFirst(PSArc::Directory& dir, std::vector<PSArc::File*>& files) {
+  for (PSArc::File* file : dir.files) {
+    if (file != nullptr)
+      files.push_back(file);
+  }
 
-    Directory& curr = current.get();
+  for (PSArc::Directory* subDirectory : dir.subDirectories) {
+    if (subDirectory != nullptr)
+      appendDepthFirst(*subDirectory, files);
+  }
+}
 
-    if (parsePath) {
-      if (it == --path.end()) {
-        // Is File
-        for (PSArc::File& file : curr.files) {
-          if (file.GetPathString(pathType) == normalizedName)
-            return std::addressof(file);
-        }
+const std::vector<PSArc::File*>& PSArc::Archive::GetFileList(IterationOrder order) {
+  std::vector<File*>& files =
+    (order == PSARC_ITERATION_ORDER_DEPTH_FIRST) ? this->indices.depthFirstFiles : this->indices.breadthFirstFiles;
 
-        return nullptr;
-      }
-      else {
-        // Is Directory
-        bool dirFound = false;
-        for (PSArc::Directory& dir : curr.subDirectories) {
-          if (dir.name == pathElementName) {
-            current  = std::ref(dir);
-            dirFound = true;
-            break;
-          }
+  // A built list is never empty, it holds at least the terminating nullptr.
+  if (!files.empty())
+    return files;
+
+  files.reserve(this->fileCount + 2);
+
+  // It is important that the manifest file is iterated over first.
+  if (this->manifest.has_value())
+    files.push_back(std::addressof(this->manifest.value()));
+
+  if (order == PSARC_ITERATION_ORDER_DEPTH_FIRST) {
+    appendDepthFirst(this->rootDirectory, files);
+  }
+  else {
+    std::vector<Directory*> level = {std::addressof(this->rootDirectory)};
+    std::vector<Directory*> nextLevel;
+
+    while (!level.empty()) {
+      for (Directory* dir : level) {
+        for (File* file : dir->files) {
+          if (file != nullptr)
+            files.push_back(file);
         }
 
-        if (!dirFound) {
-          return nullptr;
+        for (Directory* subDirectory : dir->subDirectories) {
+          if (subDirectory != nullptr)
+            nextLevel.push_back(subDirectory);
         }
       }
-    }
-    else {
-      if (pathElementName[0] == '/') {
-        parsePath = true;
-      }
+
+      level.swap(nextLevel);
+      nextLevel.clear();
     }
   }
 
-  return nullptr;
+  files.push_back(nullptr);
+  return files;
 }
 
-size_t PSArc::Archive::GetFileCount() const noexcept {
-  return this->fileCount;
+PSArc::Archive::FileRange PSArc::Archive::GetFiles(IterationOrder order) {
+  const std::vector<File*>& files = GetFileList(order);
+  return FileRange {Iterator(files.data()), Iterator(files.data() + files.size() - 1)};
+}
+
+std::vector<PSArc::File*> PSArc::Archive::FindFilesWithPrefix(const std::string& prefix) {
+  return GetPathIndex().FindWithPrefix(prefix);
+}
+
+std::vector<PSArc::File*> PSArc::Archive::FindFilesMatching(const std::string& pattern) {
+  return GetPathIndex().FindMatching(pattern);
+}
+
+void PSArc::Archive::SetMemoryBudget(size_t budget) {
+  this->cache = (budget != 0) ? std::make_shared<FileCache>(budget) : nullptr;
+
+  for (File* file : *this) {
+    file->SetCache(this->cache);
+  }
 }
 
 size_t PSArc::File::GetUncompressedSize() const noexcept {
-  if (this->uncompressedBytes.has_value()) {
-    return this->uncompressedBytes.value().uncompressedTotalSize;
+  if (std::shared_ptr<FileData> uncompressedData = PeekState(this->uncompressedBytes)) {
+    return uncompressedData->uncompressedTotalSize;
   }
 
-  if (this->compressedBytes.has_value()) {
-    return this->compressedBytes.value().uncompressedTotalSize;
+  if (std::shared_ptr<FileData> compressedData = PeekState(this->compressedBytes)) {
+    return compressedData->uncompressedTotalSize;
   }
 
-  if (this->source->HasUncompressedSize()) {
+  if (this->source != nullptr && this->source->HasUncompressedSize()) {
     return this->source->GetUncompressedSize();
   }
 
@@ -274,23 +1438,40 @@ size_t PSArc::File::GetUncompressedSize() const noexcept {
 }
 
 size_t PSArc::File::GetCompressedSize() {
-  if (!this->compressedBytes.has_value()) {
-    this->LoadCompressedBytes();
+  if (PeekState(this->compressedBytes) == nullptr && this->source != nullptr && this->compressedSource) {
+    size_t compressedSize = 0;
+    for (const BlockDescriptor& block : GetCompressedBlocks()) {
+      compressedSize += block.compressedSize;
+    }
+
+    return compressedSize;
   }
 
-  return this->compressedBytes.value().bytes.size();
+  std::shared_ptr<FileData> compressedData = AcquireCompressedState();
+  if (compressedData == nullptr)
+    return 0;
+
+  return compressedData->bytes.size();
+}
+
+bool PSArc::File::HasSource() const noexcept {
+  return this->source != nullptr;
+}
+
+bool PSArc::File::CanClearCompressedBytes() const noexcept {
+  return this->source != nullptr || PeekState(this->uncompressedBytes) != nullptr;
 }
 
 bool PSArc::File::IsUncompressedSizeAvailable() const noexcept {
-  if (this->uncompressedBytes.has_value()) {
+  if (PeekState(this->uncompressedBytes) != nullptr) {
     return true;
   }
 
-  if (this->compressedBytes.has_value()) {
+  if (PeekState(this->compressedBytes) != nullptr) {
     return true;
   }
 
-  if (this->source->HasUncompressedSize()) {
+  if (this->source != nullptr && this->source->HasUncompressedSize()) {
     return true;
   }
 
@@ -298,83 +1479,177 @@ bool PSArc::File::IsUncompressedSizeAvailable() const noexcept {
 }
 
 bool PSArc::File::IsCompressedSizeAvailable() const noexcept {
-  return this->compressedBytes.has_value();
+  return PeekState(this->compressedBytes) != nullptr;
 }
 
-std::vector<size_t>& PSArc::File::GetCompressedBlockSizes() {
-  if (this->compressedBytes.has_value()) {
-    return this->compressedBytes.value().compressedBlockSizes;
-  }
-  else {
-    this->LoadCompressedBytes();
+bool PSArc::File::HasCompressedBlocks() const noexcept {
+  return PeekState(this->compressedBytes) != nullptr || (this->source != nullptr && this->compressedSource);
+}
+
+std::vector<PSArc::BlockDescriptor> PSArc::File::GetCompressedBlocks() {
+  // Returned by value, the compressed state may be evicted as soon as it is no longer referenced.
+  std::shared_ptr<FileData> compressedData = GetState(this->compressedBytes);
+
+  // A compressed source already knows its block layout, there is no need to read its data.
+  if (compressedData == nullptr && this->source != nullptr && this->compressedSource && this->source->SupportsBlockAccess()) {
+    std::vector<BlockDescriptor> blocks(this->source->GetBlockCount());
+    for (size_t i = 0; i < blocks.size(); i++) {
+      blocks[i] = this->source->GetBlockDescriptor(i);
+    }
+
+    return blocks;
   }
 
-  return this->compressedBytes.value().compressedBlockSizes;
+  compressedData = AcquireCompressedState();
+
+  return compressedData->blocks;
 }
 
 bool PSArc::File::IsManifest() const noexcept {
-  return this->GetPathString(PathType::PSARC_PATH_TYPE_RELATIVE) == "PSArcManifest.bin";
+  return GetPathView(PathType::PSARC_PATH_TYPE_RELATIVE) == "PSArcManifest.bin";
+}
+
+void PSArc::File::SetPath(std::string name) {
+  this->path = std::move(name);
+  SetPathStrings();
+}
+
+void PSArc::File::SetPathStrings() {
+  this->absolutePath    = this->path.generic_string();
+  this->hasLeadingSlash = !this->absolutePath.empty() && this->absolutePath.front() == '/';
+
+  if (!this->hasLeadingSlash)
+    this->absolutePath.insert(this->absolutePath.begin(), '/');
 }
 
 std::string PSArc::File::GetPathString(PathType pathType) const noexcept {
-  std::string filePath = this->path.generic_string();
+  return std::string(GetPathView(pathType));
+}
+
+std::string_view PSArc::File::GetPathView(PathType pathType) const noexcept {
+  const std::string_view absolute = this->absolutePath;
 
   switch (pathType) {
     case PSARC_PATH_TYPE_RELATIVE:
-      if (filePath.front() == '/') {
-        filePath = filePath.substr(1);
-      }
-      break;
-    case PSARC_PATH_TYPE_IGNORECASE:
-      break;
+      return absolute.substr(1);
     case PSARC_PATH_TYPE_ABSOLUTE:
-      if (filePath.front() != '/') {
-        filePath = "/" + filePath;
-      }
-      break;
+      return absolute;
+    case PSARC_PATH_TYPE_IGNORECASE:
     default:
-      break;
+      // The path as it was given.
+      return this->hasLeadingSlash ? absolute : absolute.substr(1);
   }
+}
 
-  return filePath;
+PSArc::FileData::~FileData() {
+  BufferPool::Get().Release(std::move(this->bytes));
 }
 
-void PSArc::FileData::Compress(FileData& dst) {
+void PSArc::FileData::Compress(FileData& dst, BlockCompressionCache* blockCache) const {
+  dst.uncompressedTotalSize = this->bytes.size();
+
+  // Blocks that do not shrink are stored, only a partial last block may come out larger than it went in. The buffer is sized for the
+  // input and grows while appending in that rare case.
+  if (dst.bytes.capacity() < this->bytes.size())
+    BufferPool::Get().Release(std::exchange(dst.bytes, BufferPool::Get().Acquire(this->bytes.size())));
+
   switch (dst.compressionType) {
     case CompressionType::PSARC_COMPRESSION_TYPE_LZMA:
-      LZMACompress(dst.bytes, this->bytes, dst.compressedBlockSizes, dst.uncompressedMaxBlockSize, dst.compressedMaxBlockSize);
+      LZMACompress(dst.bytes, this->bytes, dst.blocks, dst.uncompressedMaxBlockSize, dst.compressedMaxBlockSize, blockCache);
       break;
     case CompressionType::PSARC_COMPRESSION_TYPE_ZLIB:
-      ZLIBCompress(dst.bytes, this->bytes, dst.compressedBlockSizes, dst.uncompressedMaxBlockSize, dst.compressedMaxBlockSize);
+      ZLIBCompress(dst.bytes, this->bytes, dst.blocks, dst.uncompressedMaxBlockSize, dst.compressedMaxBlockSize, blockCache);
       break;
     case CompressionType::PSARC_COMPRESSION_TYPE_NONE:
-      dst = *this;
+      // Every block is stored as is, the block table still needs an entry per block.
+      dst.bytes = this->bytes;
+      dst.blocks.resize(PSArc::GetBlockCount(dst.uncompressedTotalSize, dst.uncompressedMaxBlockSize));
+      for (size_t i = 0; i < dst.blocks.size(); ++i) {
+        dst.blocks[i].compressedSize = uint32_t(GetUncompressedBlockSize(i, dst.uncompressedTotalSize, dst.uncompressedMaxBlockSize));
+        dst.blocks[i].isCompressed   = false;
+      }
       break;
     default:
       break;
   }
+}
+
+void PSArc::FileData::Decompress(FileData& dst) const {
+  if (this->compressionType == CompressionType::PSARC_COMPRESSION_TYPE_NONE) {
+    dst = *this;
+    return;
+  }
 
-  // Populate blockIsCompressed: a compressedBlockSize of 0 signals a full-size
-  // uncompressed block (PSArc convention); all other blocks are compressed.
-  if (dst.compressionType != CompressionType::PSARC_COMPRESSION_TYPE_NONE) {
-    dst.blockIsCompressed.resize(dst.compressedBlockSizes.size());
-    for (size_t i = 0; i < dst.compressedBlockSizes.size(); ++i)
-      dst.blockIsCompressed[i] = (dst.compressedBlockSizes[i] != 0);
+  dst.uncompressedMaxBlockSize = this->uncompressedMaxBlockSize;
+  dst.compressedMaxBlockSize   = this->compressedMaxBlockSize;
+
+  if (dst.bytes.capacity() < this->uncompressedTotalSize)
+    BufferPool::Get().Release(std::exchange(dst.bytes, BufferPool::Get().Acquire(this->uncompressedTotalSize)));
+
+  dst.bytes.resize(this->uncompressedTotalSize);
+
+  if (DecompressInto(dst.bytes, 0, GetBlockCount())) {
+    dst.uncompressedTotalSize = this->uncompressedTotalSize;
+  }
+  else {
+    dst.bytes.clear();
+    dst.uncompressedTotalSize = 0;
   }
 }
 
-void PSArc::FileData::Decompress(FileData& dst) {
-  switch (this->compressionType) {
-    case CompressionType::PSARC_COMPRESSION_TYPE_LZMA:
-      dst.uncompressedTotalSize = LZMADecompress(dst.bytes, this->bytes, this->compressedBlockSizes, this->blockIsCompressed);
-      break;
-    case CompressionType::PSARC_COMPRESSION_TYPE_ZLIB:
-      dst.uncompressedTotalSize = ZLIBDecompress(dst.bytes, this->bytes, this->compressedBlockSizes, this->blockIsCompressed);
-      break;
-    case CompressionType::PSARC_COMPRESSION_TYPE_NONE:
-      dst = *this;
-      break;
-    default:
-      break;
+bool PSArc::FileData::DecompressInto(std::span<byte> dst, size_t firstBlock, size_t blockCount) const {
+  const size_t totalBlockCount = GetBlockCount();
+
+  if (firstBlock > totalBlockCount || blockCount > totalBlockCount - firstBlock)
+    return false;
+
+  const size_t maxBlockSize = (this->uncompressedMaxBlockSize != 0) ? this->uncompressedMaxBlockSize : this->uncompressedTotalSize;
+  const size_t rangeStart   = firstBlock * maxBlockSize;
+  const size_t rangeEnd     = std::min(this->uncompressedTotalSize, (firstBlock + blockCount) * maxBlockSize);
+
+  if (dst.size() != rangeEnd - rangeStart)
+    return false;
+
+  if (this->compressionType == CompressionType::PSARC_COMPRESSION_TYPE_NONE) {
+    if (rangeEnd > this->bytes.size())
+      return false;
+
+    std::memcpy(dst.data(), this->bytes.data() + rangeStart, dst.size());
+    return true;
+  }
+
+  if (firstBlock + blockCount > this->blocks.size())
+    return false;
+
+  size_t inputOffset = 0;
+  for (size_t i = 0; i < firstBlock; i++) {
+    inputOffset += this->blocks[i].compressedSize;
+  }
+
+  size_t outputOffset = 0;
+  for (size_t i = firstBlock; i < firstBlock + blockCount; i++) {
+    const size_t inputSize  = this->blocks[i].compressedSize;
+    const size_t outputSize = GetUncompressedBlockSize(i, this->uncompressedTotalSize, maxBlockSize);
+
+    if (inputOffset + inputSize > this->bytes.size())
+      return false;
+
+    std::span<const byte> blockInput(this->bytes.data() + inputOffset, inputSize);
+    std::span<byte> blockOutput = dst.subspan(outputOffset, outputSize);
+
+    if (!decompressBlock(this->compressionType, this->blocks[i], blockOutput, blockInput))
+      return false;
+
+    inputOffset += inputSize;
+    outputOffset += outputSize;
   }
+
+  return true;
+}
+
+size_t PSArc::FileData::GetBlockCount() const noexcept {
+  if (this->uncompressedMaxBlockSize == 0)
+    return (this->uncompressedTotalSize > 0) ? 1 : 0;
+
+  return PSArc::GetBlockCount(this->uncompressedTotalSize, this->uncompressedMaxBlockSize);
 }
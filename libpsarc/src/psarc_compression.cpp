@@ -2,29 +2,227 @@
 
 #include <cstring>
 #include <iostream>
+#include <utility>
+#include <vector>
 
 #include "LzmaDec.h"
 #include "LzmaEnc.h"
+#include "md5.h"
 #include "zlib.h"
 
+#define LZMA_ALLOCATION_HEADER_SIZE 16
+#define LZMA_MAX_POOLED_ALLOCATIONS 16
+#define LZMA_MAX_POOLED_BYTES (64 * 1024 * 1024)
+
+/*
+ * The LZMA SDK allocates its match finder and probability tables anew for every block. Freed allocations are kept in a per thread
+ * pool and handed out again for the same size, hence a worker allocates these tables once instead of once per block.
+ * Every allocation is prefixed with its size since ISzAlloc does not pass it to Free.
+ * The encoder and decoder live in the same state so they are destroyed before the pool they free their allocations into.
+ */
+struct LzmaThreadState {
+  std::vector<std::pair<size_t, byte*>> freeAllocations;
+  size_t pooledBytes = 0;
+
+  CLzmaEncHandle encoder = nullptr;
+
+  CLzmaDec decoder;
+  bool decoderReady = false;
+  byte decoderProps[LZMA_PROPS_SIZE];
+
+  LzmaThreadState() {
+    LzmaDec_CONSTRUCT(&this->decoder);
+  }
+  ~LzmaThreadState();
+};
+
+static thread_local LzmaThreadState lzmaThreadState;
+
 static void* lzmaAlloc(ISzAllocPtr, size_t size) {
-  return new byte[size];
+  std::vector<std::pair<size_t, byte*>>& freeAllocations = lzmaThreadState.freeAllocations;
+
+  // Most recently freed allocations are the most likely to be requested again.
+  for (size_t i = freeAllocations.size(); i-- > 0;) {
+    if (freeAllocations[i].first == size) {
+      byte* allocation = freeAllocations[i].second;
+      freeAllocations.erase(freeAllocations.begin() + i);
+      lzmaThreadState.pooledBytes -= size;
+      return allocation + LZMA_ALLOCATION_HEADER_SIZE;
+    }
+  }
+
+  byte* allocation = new byte[size + LZMA_ALLOCATION_HEADER_SIZE];
+  std::memcpy(allocation, &size, sizeof(size));
+  return allocation + LZMA_ALLOCATION_HEADER_SIZE;
 }
 
 static void lzmaFree(ISzAllocPtr, void* ptr) {
   if (!ptr)
     return;
 
-  delete[] reinterpret_cast<byte*>(ptr);
+  byte* allocation = reinterpret_cast<byte*>(ptr) - LZMA_ALLOCATION_HEADER_SIZE;
+  size_t size;
+  std::memcpy(&size, allocation, sizeof(size));
+
+  if (size > LZMA_MAX_POOLED_BYTES) {
+    delete[] allocation;
+    return;
+  }
+
+  std::vector<std::pair<size_t, byte*>>& freeAllocations = lzmaThreadState.freeAllocations;
+
+  // Drop the oldest allocations when the pool is full.
+  while (!freeAllocations.empty() &&
+         (freeAllocations.size() >= LZMA_MAX_POOLED_ALLOCATIONS || lzmaThreadState.pooledBytes + size > LZMA_MAX_POOLED_BYTES)) {
+    lzmaThreadState.pooledBytes -= freeAllocations.front().first;
+    delete[] freeAllocations.front().second;
+    freeAllocations.erase(freeAllocations.begin());
+  }
+
+  freeAllocations.emplace_back(size, allocation);
+  lzmaThreadState.pooledBytes += size;
 }
 
 static ISzAlloc lzmaAllocFuncs = {.Alloc = lzmaAlloc, .Free = lzmaFree};
 
+LzmaThreadState::~LzmaThreadState() {
+  if (this->encoder != nullptr)
+    LzmaEnc_Destroy(this->encoder, &lzmaAllocFuncs, &lzmaAllocFuncs);
+
+  LzmaDec_FreeProbs(&this->decoder, &lzmaAllocFuncs);
+
+  for (const std::pair<size_t, byte*>& allocation : this->freeAllocations) {
+    delete[] allocation.second;
+  }
+}
+
+/*
+ * Returns the encoder of this thread configured with props. The encoder is kept across blocks and files, every encode call
+ * only resets its state instead of creating and configuring a new one.
+ */
+static CLzmaEncHandle getLzmaEncoder(const CLzmaEncProps& props) {
+  if (lzmaThreadState.encoder == nullptr)
+    lzmaThreadState.encoder = LzmaEnc_Create(&lzmaAllocFuncs);
+
+  if (lzmaThreadState.encoder == nullptr || LzmaEnc_SetProps(lzmaThreadState.encoder, &props) != SZ_OK)
+    return nullptr;
+
+  return lzmaThreadState.encoder;
+}
+
+/*
+ * Decodes a single LZMA stream straight into dst with the decoder of this thread. The probability tables are only set up again
+ * when the props differ from the previous block, otherwise the decoder is merely reset.
+ * Behaves like LzmaDecode with LZMA_FINISH_END.
+ */
+static SRes decodeLzmaBlock(byte* dst, SizeT* dstSize, const byte* src, SizeT* srcSize, const byte* propsEncoded, ELzmaStatus* status) {
+  CLzmaDec& decoder = lzmaThreadState.decoder;
+
+  const SizeT outputSize = *dstSize;
+  const SizeT inputSize  = *srcSize;
+  *dstSize = *srcSize = 0;
+  *status             = LZMA_STATUS_NOT_SPECIFIED;
+
+  if (!lzmaThreadState.decoderReady || std::memcmp(lzmaThreadState.decoderProps, propsEncoded, LZMA_PROPS_SIZE) != 0) {
+    lzmaThreadState.decoderReady = false;
+
+    SRes res = LzmaDec_AllocateProbs(&decoder, propsEncoded, LZMA_PROPS_SIZE, &lzmaAllocFuncs);
+    if (res != SZ_OK)
+      return res;
+
+    std::memcpy(lzmaThreadState.decoderProps, propsEncoded, LZMA_PROPS_SIZE);
+    lzmaThreadState.decoderReady = true;
+  }
+
+  decoder.dic        = dst;
+  decoder.dicBufSize = outputSize;
+  LzmaDec_Init(&decoder);
+
+  *srcSize = inputSize;
+  SRes res = LzmaDec_DecodeToDic(&decoder, outputSize, src, srcSize, LZMA_FINISH_END, status);
+  *dstSize = decoder.dicPos;
+
+  if (res == SZ_OK && *status == LZMA_STATUS_NEEDS_MORE_INPUT)
+    res = SZ_ERROR_INPUT_EOF;
+
+  // The output buffer belongs to the caller, FreeProbs must never see it.
+  decoder.dic = nullptr;
+  return res;
+}
+
 #define LZMA_HEADER_SIZE 13
 
+PSArc::BlockFingerprint PSArc::BlockCompressionCache::Fingerprint(std::span<const byte> block) {
+  MD5Context md5Context;
+  md5Init(&md5Context);
+  md5Update(&md5Context, block.data(), block.size());
+  md5Finalize(&md5Context);
+
+  BlockFingerprint fingerprint;
+  std::memcpy(fingerprint.data(), md5Context.digest, fingerprint.size());
+  return fingerprint;
+}
+
+bool PSArc::BlockCompressionCache::Find(
+  const BlockFingerprint& fingerprint, std::span<const byte> block, std::vector<byte>& dst, size_t offset, BlockDescriptor& descriptor) {
+  std::shared_ptr<const CachedBlock> cachedBlock;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    auto entry = this->cachedBlocks.find(fingerprint);
+    if (entry == this->cachedBlocks.end())
+      return false;
+
+    cachedBlock = entry->second;
+  }
+
+  // Verify the hit, decompressing a block is far cheaper than compressing it.
+  bool matches = false;
+  if (!cachedBlock->descriptor.isCompressed) {
+    matches = std::equal(block.begin(), block.end(), cachedBlock->bytes.begin(), cachedBlock->bytes.end());
+  }
+  else {
+    std::vector<byte>& uncompressed = GetScratchBuffer(PSARC_SCRATCH_BUFFER_UNCOMPRESSED_BLOCK);
+    bool decompressed               = false;
+
+    uncompressed.resize(block.size());
+
+    if (this->compressionType == CompressionType::PSARC_COMPRESSION_TYPE_LZMA)
+      decompressed = LZMADecompressBlock(uncompressed, cachedBlock->bytes);
+    else if (this->compressionType == CompressionType::PSARC_COMPRESSION_TYPE_ZLIB)
+      decompressed = ZLIBDecompressBlock(uncompressed, cachedBlock->bytes);
+
+    matches = decompressed && std::equal(block.begin(), block.end(), uncompressed.begin());
+  }
+
+  if (!matches)
+    return false;
+
+  dst.resize(offset + cachedBlock->bytes.size());
+  std::memcpy(dst.data() + offset, cachedBlock->bytes.data(), cachedBlock->bytes.size());
+  descriptor = cachedBlock->descriptor;
+
+  this->hitCount.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void PSArc::BlockCompressionCache::Insert(const BlockFingerprint& fingerprint, std::span<const byte> stored, BlockDescriptor descriptor) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  if (this->usage + stored.size() > this->capacity || this->cachedBlocks.contains(fingerprint))
+    return;
+
+  this->cachedBlocks.emplace(fingerprint, std::make_shared<const CachedBlock>(CachedBlock {{stored.begin(), stored.end()}, descriptor}));
+  this->usage += stored.size();
+}
+
+size_t PSArc::BlockCompressionCache::GetHitCount() const noexcept {
+  return this->hitCount.load(std::memory_order_relaxed);
+}
+
 void PSArc::LZMACompress(
-  std::vector<byte>& dst, const std::vector<byte>& src, std::vector<size_t>& compressedBlockSizes, size_t maxUncompressedBlockSize,
-  size_t maxCompressedBlockSize) {
+  std::vector<byte>& dst, const std::vector<byte>& src, std::vector<BlockDescriptor>& blocks, size_t maxUncompressedBlockSize,
+  size_t maxCompressedBlockSize, BlockCompressionCache* blockCache) {
   CLzmaEncProps props;
   LzmaEncProps_Init(&props);
 
@@ -47,44 +245,75 @@ void PSArc::LZMACompress(
     return;
   }
 
+  // Every block is encoded with the same props, hence the encoder is configured once per call.
+  CLzmaEncHandle encoder = getLzmaEncoder(props);
+  if (encoder == nullptr || LzmaEnc_WriteProperties(encoder, propsEncoded, &propsSize) != SZ_OK) {
+    std::cout << "Fatal Error in compression: Failed to set up the LZMA encoder." << std::endl;
+    return;
+  }
+
   SizeT totalCompressedSize = 0;
   SizeT totalProcessedSize  = 0;
 
-  compressedBlockSizes.clear();
+  // Blocks are encoded into scratch memory of the maximum block size, only the bytes actually produced are appended to dst.
+  std::vector<byte>& compressedBlock = GetScratchBuffer(PSARC_SCRATCH_BUFFER_COMPRESSED_BLOCK);
+  if (compressedBlock.size() < maxCompressedBlockSize)
+    compressedBlock.resize(maxCompressedBlockSize);
+
+  dst.clear();
+  blocks.clear();
 
   while (totalProcessedSize < uncompressedSize) {
     SizeT processSize         = std::min((SizeT) maxUncompressedBlockSize, uncompressedSize - totalProcessedSize);
     SizeT compressedBlockSize = maxCompressedBlockSize;
 
-    dst.resize(totalCompressedSize + compressedBlockSize);
+    std::span<const byte> block(src.data() + totalProcessedSize, processSize);
+    BlockFingerprint fingerprint;
+
+    if (blockCache != nullptr) {
+      BlockDescriptor cachedDescriptor;
+      fingerprint = BlockCompressionCache::Fingerprint(block);
+
+      if (blockCache->Find(fingerprint, block, dst, totalCompressedSize, cachedDescriptor)) {
+        blocks.push_back(cachedDescriptor);
+        totalCompressedSize += cachedDescriptor.compressedSize;
+        totalProcessedSize += processSize;
+        continue;
+      }
+    }
 
     SizeT compressedOutputSize = compressedBlockSize - LZMA_HEADER_SIZE;
 
     SizeT actualBlockSize = compressedBlockSize;  // how many bytes are actually written to dst
 
-    SRes lzmaStatus = LzmaEncode(
-      dst.data() + totalCompressedSize + LZMA_HEADER_SIZE, &compressedOutputSize, src.data() + totalProcessedSize, processSize, &props,
-      propsEncoded, &propsSize, 0, nullptr, &lzmaAllocFuncs, &lzmaAllocFuncs);
+    SRes lzmaStatus = LzmaEnc_MemEncode(
+      encoder, compressedBlock.data() + LZMA_HEADER_SIZE, &compressedOutputSize, src.data() + totalProcessedSize, processSize, 0, nullptr,
+      &lzmaAllocFuncs, &lzmaAllocFuncs);
+
+    // A compressed block of exactly the uncompressed size would be classified as stored, so store it instead.
+    if (lzmaStatus == SZ_OK && compressedOutputSize + LZMA_HEADER_SIZE == processSize) {
+      lzmaStatus = SZ_ERROR_OUTPUT_EOF;
+    }
 
     if (lzmaStatus == SZ_OK) {
       // All good — write the 13-byte LZMA header followed by the compressed payload.
       actualBlockSize     = compressedOutputSize + LZMA_HEADER_SIZE;
       compressedBlockSize = actualBlockSize;
 
-      std::memcpy(dst.data() + totalCompressedSize, propsEncoded, 5);
+      std::memcpy(compressedBlock.data(), propsEncoded, 5);
 
       // This is funky, PSArc LZMA block header requires a uint64_t but LZMA uses size_t which is not necessarily that.
       // TODO: Header requires little endian, make it so that libpsarc also works on big endian machines.
-      std::memcpy(dst.data() + totalCompressedSize + 5, &processSize, 8);
+      std::memcpy(compressedBlock.data() + 5, &processSize, 8);
+
+      dst.insert(dst.end(), compressedBlock.begin(), compressedBlock.begin() + actualBlockSize);
     }
     else if (lzmaStatus == SZ_ERROR_OUTPUT_EOF) {
       // Compression did not reduce file size, hence we store this block uncompressed (no LZMA header).
-      std::memcpy(dst.data() + totalCompressedSize, src.data() + totalProcessedSize, processSize);
-      // A full block stored uncompressed is signalled by a block table entry of 0.
-      // Partial (last) blocks keep their real size so the reader knows how many bytes to consume.
-      // actualBlockSize always tracks the real bytes written, regardless of the table entry.
+      // The block size is the real size, the block table entry of 0 for full blocks is only written during serialization.
+      dst.insert(dst.end(), block.begin(), block.end());
       actualBlockSize     = processSize;
-      compressedBlockSize = (processSize == maxUncompressedBlockSize) ? 0 : processSize;
+      compressedBlockSize = processSize;
     }
     else {
       // Probably wanna avoid exceptions and use flags instead.
@@ -92,18 +321,19 @@ void PSArc::LZMACompress(
       return;
     }
 
-    compressedBlockSizes.push_back(compressedBlockSize);
+    const BlockDescriptor descriptor = {uint32_t(compressedBlockSize), IsBlockCompressed(compressedBlockSize, processSize)};
+    blocks.push_back(descriptor);
+
+    if (blockCache != nullptr)
+      blockCache->Insert(fingerprint, std::span<const byte>(dst.data() + totalCompressedSize, actualBlockSize), descriptor);
 
     totalCompressedSize += actualBlockSize;
     totalProcessedSize += processSize;
   }
-
-  dst.resize(totalCompressedSize);
 }
 
 size_t PSArc::LZMADecompress(
-  std::vector<byte>& dst, const std::vector<byte>& src, const std::vector<size_t>& compressedBlockSizes,
-  const std::vector<bool>& blockIsCompressed) {
+  std::vector<byte>& dst, const std::vector<byte>& src, const std::vector<BlockDescriptor>& blocks, size_t uncompressedTotalSize) {
   SizeT totalOutputSize = 0;
 
   SizeT uncompressedOffset = 0;
@@ -115,13 +345,21 @@ size_t PSArc::LZMADecompress(
 
   ELzmaStatus lzmaStatus;
 
+  // When the total size is known, the output is allocated once and every block is decoded straight into its final position.
+  if (uncompressedTotalSize != 0) {
+    dst.resize(uncompressedTotalSize);
+  }
+
   while (remainingInput > 0) {
     // When there is no block information, we simply will have no idea but we can simply guess that it must be the last block and that it is
     // not compressed.
-    bool isCompressed = (blockNum < blockIsCompressed.size()) ? blockIsCompressed[blockNum] : false;
+    const bool hasBlockInfo = blockNum < blocks.size();
+    const bool isCompressed = hasBlockInfo && blocks[blockNum].isCompressed;
 
     if (isCompressed) {
-      if (remainingInput < LZMA_HEADER_SIZE) {
+      const SizeT blockInputSize = blocks[blockNum].compressedSize;
+
+      if (blockInputSize < LZMA_HEADER_SIZE || blockInputSize > remainingInput) {
         // Compressed blocks must have at least a 13-byte LZMA header.
         std::cout << "Fatal Error in decompression: Encountered non LZMA compliant header." << std::endl;
         return 0;
@@ -135,18 +373,19 @@ size_t PSArc::LZMADecompress(
 
       totalOutputSize += uncompressedSize;
 
-      dst.resize(totalOutputSize);
+      if (totalOutputSize > dst.size())
+        dst.resize(totalOutputSize);
 
-      SizeT processedInput = compressedBlockSizes[blockNum];
+      SizeT processedInput = blockInputSize - LZMA_HEADER_SIZE;
 
-      SRes status = LzmaDecode(
+      SRes status = decodeLzmaBlock(
         dst.data() + uncompressedOffset, &uncompressedSize, src.data() + inputOffset + LZMA_HEADER_SIZE, &processedInput,
-        src.data() + inputOffset, 5, LZMA_FINISH_END, &lzmaStatus, &lzmaAllocFuncs);
+        src.data() + inputOffset, &lzmaStatus);
 
       uncompressedOffset += uncompressedSize;
 
-      remainingInput -= processedInput + LZMA_HEADER_SIZE;
-      inputOffset += processedInput + LZMA_HEADER_SIZE;
+      remainingInput -= blockInputSize;
+      inputOffset += blockInputSize;
 
       if (status != SZ_OK) {
         // What should we do on error?
@@ -156,10 +395,13 @@ size_t PSArc::LZMADecompress(
     }
     else {
       // This block is not compressed
-      size_t sizeOfBlock = (blockNum < blockIsCompressed.size()) ? compressedBlockSizes[blockNum] : remainingInput;
+      size_t sizeOfBlock = hasBlockInfo ? blocks[blockNum].compressedSize : remainingInput;
 
       totalOutputSize += sizeOfBlock;
-      dst.resize(totalOutputSize);
+
+      if (totalOutputSize > dst.size())
+        dst.resize(totalOutputSize);
+
       std::memcpy(dst.data() + uncompressedOffset, src.data() + inputOffset, sizeOfBlock);
 
       uncompressedOffset += sizeOfBlock;
@@ -174,9 +416,37 @@ size_t PSArc::LZMADecompress(
   return totalOutputSize;
 }
 
+bool PSArc::LZMADecompressBlock(std::span<byte> dst, std::span<const byte> src) {
+  if (src.size() < LZMA_HEADER_SIZE) {
+    std::cout << "Fatal Error in decompression: Encountered non LZMA compliant header." << std::endl;
+    return false;
+  }
+
+  uint64_t headerUncompressedSize;
+  std::memcpy(&headerUncompressedSize, src.data() + 5, 8);
+
+  if (headerUncompressedSize != dst.size()) {
+    std::cout << "Fatal Error in decompression: LZMA header does not match the size of the block." << std::endl;
+    return false;
+  }
+
+  SizeT uncompressedSize = dst.size();
+  SizeT processedInput   = src.size() - LZMA_HEADER_SIZE;
+  ELzmaStatus lzmaStatus;
+
+  SRes status = decodeLzmaBlock(dst.data(), &uncompressedSize, src.data() + LZMA_HEADER_SIZE, &processedInput, src.data(), &lzmaStatus);
+
+  if (status != SZ_OK || uncompressedSize != dst.size()) {
+    std::cout << "Fatal Error in decompression: Encountered unhandled LZMA error code (" << status << ")." << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
 void PSArc::ZLIBCompress(
-  std::vector<byte>& dst, const std::vector<byte>& src, std::vector<size_t>& compressedBlockSizes, size_t maxUncompressedBlockSize,
-  size_t maxCompressedBlockSize) {
+  std::vector<byte>& dst, const std::vector<byte>& src, std::vector<BlockDescriptor>& blocks, size_t maxUncompressedBlockSize,
+  size_t maxCompressedBlockSize, BlockCompressionCache* blockCache) {
   SizeT uncompressedSize = src.size();
 
   if (maxUncompressedBlockSize == 0) {
@@ -187,31 +457,53 @@ void PSArc::ZLIBCompress(
   SizeT totalCompressedSize = 0;
   SizeT totalProcessedSize  = 0;
 
-  compressedBlockSizes.clear();
+  // Like LZMACompress, blocks are compressed into scratch memory and only the bytes actually produced are appended to dst.
+  std::vector<byte>& compressedBlock = GetScratchBuffer(PSARC_SCRATCH_BUFFER_COMPRESSED_BLOCK);
+  if (compressedBlock.size() < maxCompressedBlockSize)
+    compressedBlock.resize(maxCompressedBlockSize);
+
+  dst.clear();
+  blocks.clear();
 
   while (totalProcessedSize < uncompressedSize) {
     uLong processSize         = (uLong) std::min((SizeT) maxUncompressedBlockSize, uncompressedSize - totalProcessedSize);
     uLong compressedBlockSize = (uLong) maxCompressedBlockSize;
 
-    dst.resize(totalCompressedSize + compressedBlockSize);
+    std::span<const byte> block(src.data() + totalProcessedSize, processSize);
+    BlockFingerprint fingerprint;
+
+    if (blockCache != nullptr) {
+      BlockDescriptor cachedDescriptor;
+      fingerprint = BlockCompressionCache::Fingerprint(block);
+
+      if (blockCache->Find(fingerprint, block, dst, totalCompressedSize, cachedDescriptor)) {
+        blocks.push_back(cachedDescriptor);
+        totalCompressedSize += cachedDescriptor.compressedSize;
+        totalProcessedSize += processSize;
+        continue;
+      }
+    }
 
     uLong actualBlockSize = compressedBlockSize;  // how many bytes are actually written to dst
 
-    int status =
-      compress((Bytef*) (dst.data() + totalCompressedSize), &compressedBlockSize, (Bytef*) (src.data() + totalProcessedSize), processSize);
+    int status = compress((Bytef*) compressedBlock.data(), &compressedBlockSize, (Bytef*) (src.data() + totalProcessedSize), processSize);
+
+    // A compressed block of exactly the uncompressed size would be classified as stored, so store it instead.
+    if (status == Z_OK && compressedBlockSize == processSize) {
+      status = Z_BUF_ERROR;
+    }
 
     if (status == Z_OK) {
       // All good; compressedBlockSize was updated by compress() to actual compressed size.
       actualBlockSize = compressedBlockSize;
+      dst.insert(dst.end(), compressedBlock.begin(), compressedBlock.begin() + actualBlockSize);
     }
     else if (status == Z_BUF_ERROR) {
       // Compression did not reduce file size, hence we store this block uncompressed.
-      std::memcpy(dst.data() + totalCompressedSize, src.data() + totalProcessedSize, processSize);
-      // A full block stored uncompressed is signalled by a block table entry of 0.
-      // Partial (last) blocks keep their real size so the reader knows how many bytes to consume.
-      // actualBlockSize always tracks the real bytes written, regardless of the table entry.
+      // The block size is the real size, the block table entry of 0 for full blocks is only written during serialization.
+      dst.insert(dst.end(), block.begin(), block.end());
       actualBlockSize     = processSize;
-      compressedBlockSize = (processSize == (uLong) maxUncompressedBlockSize) ? 0 : processSize;
+      compressedBlockSize = processSize;
     }
     else {
       // Probably wanna avoid exceptions and use flags instead.
@@ -219,18 +511,20 @@ void PSArc::ZLIBCompress(
       return;
     }
 
-    compressedBlockSizes.push_back(compressedBlockSize);
+    const BlockDescriptor descriptor = {uint32_t(compressedBlockSize), IsBlockCompressed(compressedBlockSize, processSize)};
+    blocks.push_back(descriptor);
+
+    if (blockCache != nullptr)
+      blockCache->Insert(fingerprint, std::span<const byte>(dst.data() + totalCompressedSize, actualBlockSize), descriptor);
 
     totalCompressedSize += actualBlockSize;
     totalProcessedSize += processSize;
   }
-
-  dst.resize(totalCompressedSize);
 }
 
 size_t PSArc::ZLIBDecompress(
-  std::vector<byte>& dst, const std::vector<byte>& src, const std::vector<size_t>& compressedBlockSizes,
-  const std::vector<bool>& blockIsCompressed) {
+  std::vector<byte>& dst, const std::vector<byte>& src, const std::vector<BlockDescriptor>& blocks, size_t uncompressedTotalSize,
+  size_t maxUncompressedBlockSize) {
   SizeT totalOutputSize = 0;
 
   SizeT uncompressedOffset = 0;
@@ -240,37 +534,58 @@ size_t PSArc::ZLIBDecompress(
 
   size_t blockNum = 0;
 
+  const bool blockSizesKnown = (uncompressedTotalSize != 0) && (maxUncompressedBlockSize != 0);
+
+  if (blockSizesKnown) {
+    dst.resize(uncompressedTotalSize);
+  }
+
   while (remainingInput > 0) {
     // When there is no block information, we simply will have no idea but we can simply guess that it must be the last block and that it is
     // not compressed.
-    bool isCompressed = (blockNum < blockIsCompressed.size()) ? blockIsCompressed[blockNum] : false;
+    const bool hasBlockInfo = blockNum < blocks.size();
+    const bool isCompressed = hasBlockInfo && blocks[blockNum].isCompressed;
 
     if (isCompressed) {
-      uLongf processedInput = uLongf(compressedBlockSizes[blockNum]);
-
-      // We don't know the size of the uncompressed block, hence just assume 2x compression and if that wasn't enough,
-      // try again with more memory.
-      SizeT initialTotalOutputSize = totalOutputSize;
-      uLongf uncompressedSize      = processedInput * 2;
+      uLongf processedInput = uLongf(blocks[blockNum].compressedSize);
       int status;
 
-      while (true) {
-        totalOutputSize = initialTotalOutputSize + uncompressedSize;
-        dst.resize(totalOutputSize);
+      if (blockSizesKnown) {
+        // The uncompressed size of every block follows from the block index, hence the block is inflated right into place.
+        uLongf uncompressedSize = uLongf(GetUncompressedBlockSize(blockNum, uncompressedTotalSize, maxUncompressedBlockSize));
 
         status = uncompress(
           (Bytef*) (dst.data() + uncompressedOffset), &uncompressedSize, (Bytef*) (src.data() + inputOffset), (uLong) processedInput);
 
-        if (status == Z_BUF_ERROR) {
-          uncompressedSize *= 2;
-        }
-        else {
-          break;
-        }
+        totalOutputSize += uncompressedSize;
+        uncompressedOffset += uncompressedSize;
       }
+      else {
+        // We don't know the size of the uncompressed block, hence just assume 2x compression and if that wasn't enough,
+        // try again with more memory.
+        SizeT initialTotalOutputSize = totalOutputSize;
+        uLongf uncompressedSize      = processedInput * 2;
+
+        while (true) {
+          totalOutputSize = initialTotalOutputSize + uncompressedSize;
+          dst.resize(totalOutputSize);
+
+          status = uncompress(
+            (Bytef*) (dst.data() + uncompressedOffset), &uncompressedSize, (Bytef*) (src.data() + inputOffset), (uLong) processedInput);
+
+          if (status == Z_BUF_ERROR) {
+            uncompressedSize *= 2;
+          }
+          else {
+            break;
+          }
+        }
 
-      totalOutputSize = initialTotalOutputSize + uncompressedSize;
-      uncompressedOffset += uncompressedSize;
+        // Shrink dst to the actual decompressed size for this block.
+        totalOutputSize = initialTotalOutputSize + uncompressedSize;
+        uncompressedOffset += uncompressedSize;
+        dst.resize(totalOutputSize);
+      }
 
       remainingInput -= processedInput;
       inputOffset += processedInput;
@@ -280,17 +595,16 @@ size_t PSArc::ZLIBDecompress(
         std::cout << "Fatal Error in decompression: Encountered unhandled ZLIB error code (" << status << ")." << std::endl;
         return 0;
       }
-
-      // Shrink dst to the actual decompressed size for this block.
-      totalOutputSize = initialTotalOutputSize + uncompressedSize;
-      dst.resize(totalOutputSize);
     }
     else {
       // This block is not compressed
-      size_t sizeOfBlock = (blockNum < blockIsCompressed.size()) ? compressedBlockSizes[blockNum] : remainingInput;
+      size_t sizeOfBlock = hasBlockInfo ? blocks[blockNum].compressedSize : remainingInput;
 
       totalOutputSize += sizeOfBlock;
-      dst.resize(totalOutputSize);
+
+      if (totalOutputSize > dst.size())
+        dst.resize(totalOutputSize);
+
       std::memcpy(dst.data() + uncompressedOffset, src.data() + inputOffset, sizeOfBlock);
 
       uncompressedOffset += sizeOfBlock;
@@ -301,5 +615,19 @@ size_t PSArc::ZLIBDecompress(
     blockNum++;
   }
 
+  dst.resize(totalOutputSize);
   return totalOutputSize;
 }
+
+bool PSArc::ZLIBDecompressBlock(std::span<byte> dst, std::span<const byte> src) {
+  uLongf uncompressedSize = uLongf(dst.size());
+
+  int status = uncompress((Bytef*) dst.data(), &uncompressedSize, (const Bytef*) src.data(), (uLong) src.size());
+
+  if (status != Z_OK || uncompressedSize != dst.size()) {
+    std::cout << "Fatal Error in decompression: Encountered unhandled ZLIB error code (" << status << ")." << std::endl;
+    return false;
+  }
+
+  return true;
+}
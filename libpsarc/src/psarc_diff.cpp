@@ -0,0 +1,142 @@
+#include "psarc_diff.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "psarc_compression.hpp"
+
+/* Compares the stored blocks of two files with the same block layout one by one, stops at the first difference. */
+static PSArc::PSArcStatus compareStoredBlocks(
+  PSArc::File& oldFile, PSArc::File& newFile, const std::vector<PSArc::BlockDescriptor>& blocks, std::vector<byte>& oldBuffer,
+  std::vector<byte>& newBuffer, bool& equal) {
+  equal = false;
+
+  size_t offset = 0;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    oldBuffer.resize(blocks[i].compressedSize);
+    newBuffer.resize(blocks[i].compressedSize);
+
+    if (!oldFile.ReadCompressedBlock(i, offset, oldBuffer) || !newFile.ReadCompressedBlock(i, offset, newBuffer))
+      return PSArc::PSARC_STATUS_ERROR_ENDPOINT;
+
+    if (std::memcmp(oldBuffer.data(), newBuffer.data(), oldBuffer.size()) != 0)
+      return PSArc::PSARC_STATUS_OK;
+
+    offset += blocks[i].compressedSize;
+  }
+
+  equal = true;
+  return PSArc::PSARC_STATUS_OK;
+}
+
+/* Compares the uncompressed content of two files of the same size, block by block if both use the same block size. */
+static PSArc::PSArcStatus compareContent(
+  PSArc::File& oldFile, PSArc::File& newFile, std::vector<byte>& oldBuffer, std::vector<byte>& newBuffer, bool& equal) {
+  equal = false;
+
+  const size_t fileSize     = oldFile.GetUncompressedSize();
+  const size_t maxBlockSize = oldFile.GetMaxBlockSize();
+
+  if (maxBlockSize == 0 || maxBlockSize != newFile.GetMaxBlockSize() || oldFile.GetBlockCount() != newFile.GetBlockCount()) {
+    oldBuffer.resize(fileSize);
+    newBuffer.resize(fileSize);
+
+    if (!oldFile.DecompressInto(oldBuffer) || !newFile.DecompressInto(newBuffer))
+      return PSArc::PSARC_STATUS_ERROR_DECOMPRESSION;
+
+    equal = (oldBuffer == newBuffer);
+    return PSArc::PSARC_STATUS_OK;
+  }
+
+  for (size_t i = 0; i < oldFile.GetBlockCount(); i++) {
+    const size_t blockSize = PSArc::GetUncompressedBlockSize(i, fileSize, maxBlockSize);
+    oldBuffer.resize(blockSize);
+    newBuffer.resize(blockSize);
+
+    if (!oldFile.DecompressInto(oldBuffer, i, 1) || !newFile.DecompressInto(newBuffer, i, 1))
+      return PSArc::PSARC_STATUS_ERROR_DECOMPRESSION;
+
+    if (oldBuffer != newBuffer)
+      return PSArc::PSARC_STATUS_OK;
+  }
+
+  equal = true;
+  return PSArc::PSARC_STATUS_OK;
+}
+
+PSArc::PSArcStatus PSArc::DiffArchives(Archive& oldArchive, Archive& newArchive, ArchiveDiff& diff) {
+  diff = ArchiveDiff {};
+
+  // Reused for every block that has to be compared, they only grow to the size of the largest block.
+  std::vector<byte> oldBuffer;
+  std::vector<byte> newBuffer;
+
+  for (File* oldFile : oldArchive.GetFiles()) {
+    if (oldFile->IsManifest())
+      continue;
+
+    const std::string path = oldFile->GetPathString(PSARC_PATH_TYPE_RELATIVE);
+    File* newFile          = newArchive.FindFile(path);
+
+    if (newFile == nullptr) {
+      diff.files.push_back(FileDiff {path, PSARC_FILE_DIFF_STATUS_REMOVED});
+      diff.removedCount++;
+      continue;
+    }
+
+    bool equal = false;
+
+    if (oldFile->GetUncompressedSize() == newFile->GetUncompressedSize()) {
+      PSArcStatus status = PSARC_STATUS_OK;
+
+      if (oldFile->HasCompressedBlocks() && newFile->HasCompressedBlocks()) {
+        // The block table is part of the TOC, only files whose blocks all have the same stored size and state need their data read.
+        const std::vector<BlockDescriptor> oldBlocks = oldFile->GetCompressedBlocks();
+        const std::vector<BlockDescriptor> newBlocks = newFile->GetCompressedBlocks();
+
+        const bool sameLayout = std::equal(
+          oldBlocks.begin(), oldBlocks.end(), newBlocks.begin(), newBlocks.end(), [](const BlockDescriptor& a, const BlockDescriptor& b) {
+            return a.compressedSize == b.compressedSize && a.isCompressed == b.isCompressed;
+          });
+
+        if (sameLayout) {
+          status = compareStoredBlocks(*oldFile, *newFile, oldBlocks, oldBuffer, newBuffer, equal);
+          diff.comparedContentCount++;
+        }
+      }
+      else {
+        // Without a stored block layout on both sides, e.g. in uncompressed archives, the content itself is compared.
+        status = compareContent(*oldFile, *newFile, oldBuffer, newBuffer, equal);
+        diff.comparedContentCount++;
+      }
+
+      if (status != PSARC_STATUS_OK)
+        return status;
+    }
+
+    if (equal) {
+      diff.files.push_back(FileDiff {path, PSARC_FILE_DIFF_STATUS_UNCHANGED});
+      diff.unchangedCount++;
+    }
+    else {
+      diff.files.push_back(FileDiff {path, PSARC_FILE_DIFF_STATUS_CHANGED});
+      diff.changedCount++;
+    }
+  }
+
+  for (File* newFile : newArchive.GetFiles()) {
+    if (newFile->IsManifest())
+      continue;
+
+    std::string path = newFile->GetPathString(PSARC_PATH_TYPE_RELATIVE);
+
+    if (oldArchive.FindFile(path) == nullptr) {
+      diff.files.push_back(FileDiff {std::move(path), PSARC_FILE_DIFF_STATUS_ADDED});
+      diff.addedCount++;
+    }
+  }
+
+  std::sort(diff.files.begin(), diff.files.end(), [](const FileDiff& a, const FileDiff& b) { return a.path < b.path; });
+
+  return PSARC_STATUS_OK;
+}
@@ -1,11 +1,19 @@
 #include "psarc_impl.hpp"
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "md5.h"
+#include "psarc_compression.hpp"
 
 static bool isPSArcFile(std::vector<byte>& header) {
   return std::memcmp(header.data(), "PSAR", 4) == 0;
@@ -62,6 +70,34 @@ static void writeCompressionType(std::vector<byte>& header, size_t offset, PSArc
   }
 }
 
+/*
+ * Classifies every block referenced by the TOC as compressed or stored and checks that the TOC and the block table agree.
+ * Returns false if any entry references blocks outside of the block table or if the block sizes contradict the compression type.
+ */
+static bool classifyBlocks(
+  const std::vector<PSArc::TocEntry>& tocEntries, PSArc::BlockDescriptor* blocks, size_t numBlocks, size_t blockSize,
+  PSArc::CompressionType compressionType) {
+  for (const PSArc::TocEntry& entry : tocEntries) {
+    const size_t blockCount = PSArc::GetBlockCount(entry.uncompressedSize, blockSize);
+
+    if (entry.blockOffset > numBlocks || blockCount > numBlocks - entry.blockOffset)
+      return false;
+
+    for (size_t i = 0; i < blockCount; i++) {
+      const size_t uncompressedBlockSize = PSArc::GetUncompressedBlockSize(i, entry.uncompressedSize, blockSize);
+      const bool isCompressed            = PSArc::IsBlockCompressed(blocks[entry.blockOffset + i].compressedSize, uncompressedBlockSize);
+
+      // Without compression every block must hold exactly its uncompressed content.
+      if (isCompressed && compressionType == PSArc::CompressionType::PSARC_COMPRESSION_TYPE_NONE)
+        return false;
+
+      blocks[entry.blockOffset + i].isCompressed = isCompressed;
+    }
+  }
+
+  return true;
+}
+
 static std::vector<std::string> GetStringsFromManifest(const std::string& s) {
   std::vector<std::string> res;
   size_t posStart = 0, posEnd;
@@ -77,6 +113,103 @@ static std::vector<std::string> GetStringsFromManifest(const std::string& s) {
   return res;
 }
 
+/*
+ * Calls func for every index in [0, count) using up to threadCount threads.
+ */
+static void forEachParallel(size_t count, size_t threadCount, const std::function<void(size_t)>& func) {
+  std::atomic<size_t> workIndex = 0;
+  std::vector<std::thread> workers;
+  workers.reserve(threadCount);
+
+  auto workerFunc = [&] {
+    while (true) {
+      const size_t i = workIndex.fetch_add(1, std::memory_order_relaxed);
+      if (i >= count)
+        break;
+
+      func(i);
+    }
+  };
+
+  for (size_t t = 0; t < threadCount; ++t)
+    workers.emplace_back(workerFunc);
+
+  for (auto& w : workers)
+    w.join();
+}
+
+/*
+ * Finds files with byte identical content. Returns for every file the index of the first file with the same content, which is the
+ * file itself if its content is unique. Only files that share their size with another file are read and hashed, every match is verified
+ * byte by byte before it is accepted.
+ */
+static std::vector<size_t> findDuplicateFiles(const std::vector<PSArc::File*>& files, size_t threadCount) {
+  std::vector<size_t> duplicateOf(files.size());
+  for (size_t i = 0; i < files.size(); i++)
+    duplicateOf[i] = i;
+
+  std::unordered_map<size_t, std::vector<size_t>> filesBySize;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (!files[i]->IsManifest())
+      filesBySize[files[i]->GetUncompressedSize()].push_back(i);
+  }
+
+  std::vector<size_t> candidates;
+  for (const auto& [size, indices] : filesBySize) {
+    if (indices.size() > 1)
+      candidates.insert(candidates.end(), indices.begin(), indices.end());
+  }
+
+  if (candidates.empty())
+    return duplicateOf;
+
+  // Keep the first occurrence of every content as the one that gets written.
+  std::sort(candidates.begin(), candidates.end());
+
+  // Content that can be read again from a source is not kept around while hashing.
+  auto releaseContent = [](PSArc::File* file) {
+    if (file->HasSource()) {
+      file->ClearUncompressedBytes();
+      file->ClearCompressedBytes();
+    }
+  };
+
+  // Sources that share an endpoint, like the files of a parsed archive, serialize their reads. Hashing still runs concurrently.
+  std::vector<std::array<byte, 16>> contentHashes(candidates.size());
+  forEachParallel(candidates.size(), threadCount, [&](size_t i) {
+    PSArc::File* file                                      = files[candidates[i]];
+    const std::shared_ptr<const std::vector<byte>> content = file->GetUncompressedBytes();
+
+    MD5Context md5Context;
+    md5Init(&md5Context);
+    md5Update(&md5Context, content->data(), content->size());
+    md5Finalize(&md5Context);
+
+    std::memcpy(contentHashes[i].data(), md5Context.digest, 16);
+    releaseContent(file);
+  });
+
+  std::map<std::pair<size_t, std::array<byte, 16>>, size_t> firstFileByContent;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    const size_t fileIndex = candidates[i];
+    auto [first, inserted] = firstFileByContent.try_emplace({files[fileIndex]->GetUncompressedSize(), contentHashes[i]}, fileIndex);
+
+    if (inserted)
+      continue;
+
+    PSArc::File* original  = files[first->second];
+    PSArc::File* duplicate = files[fileIndex];
+
+    if (*original->GetUncompressedBytes() == *duplicate->GetUncompressedBytes())
+      duplicateOf[fileIndex] = first->second;
+
+    releaseContent(original);
+    releaseContent(duplicate);
+  }
+
+  return duplicateOf;
+}
+
 PSArc::PSArcHandle::PSArcHandle() {
 }
 
@@ -118,34 +251,41 @@ PSArc::PSArcStatus PSArc::PSArcHandle::Downsync(PSArcSettings settings, std::fun
   // If a manifest file already existed, sort the files according to the original manifest.
   // Some games require the files to come in a very specific order.
   if (manifestFile != nullptr) {
-    const std::shared_ptr<std::vector<byte>> manifestBytes = manifestFile->GetUncompressedBytes();
+    const std::shared_ptr<const std::vector<byte>> manifestBytes = manifestFile->GetUncompressedBytes();
 
     std::string fileNames                        = std::string(manifestBytes->begin(), manifestBytes->end());
     const std::vector<std::string> listFileNames = GetStringsFromManifest(fileNames);
 
-    uint32_t index = 0;
+    // Positions of the files in sortedFiles, kept up to date while listed files are swapped to the front.
+    std::unordered_map<const File*, size_t> positions;
+    positions.reserve(sortedFiles.size());
+    for (size_t i = 0; i < sortedFiles.size(); i++)
+      positions.emplace(sortedFiles[i], i);
+
+    size_t index = 0;
 
-    for (uint32_t i = 0; i < listFileNames.size(); i++) {
-      File* file = this->archiveEndpoint->FindFile(listFileNames[i], this->pathType);
+    for (const std::string& fileName : listFileNames) {
+      File* file = this->archiveEndpoint->FindFile(fileName, this->pathType);
 
       // File was listed in original manifest but seems to have been removed.
       if (file == nullptr)
         continue;
 
-      uint32_t originalFileIndex;
-      for (originalFileIndex = index; originalFileIndex < sortedFiles.size(); originalFileIndex++) {
-        if (sortedFiles[originalFileIndex] == file)
-          break;
-      }
-
-      if (originalFileIndex != sortedFiles.size()) {
-        if (originalFileIndex != index) {
-          sortedFiles[originalFileIndex] = sortedFiles[index];
-          sortedFiles[index]             = file;
-        }
+      // A file listed more than once already has its place in front of index.
+      auto position = positions.find(file);
+      if (position == positions.end() || position->second < index)
+        continue;
 
-        index++;
+      const size_t originalFileIndex = position->second;
+      if (originalFileIndex != index) {
+        File* displacedFile            = sortedFiles[index];
+        sortedFiles[originalFileIndex] = displacedFile;
+        sortedFiles[index]             = file;
+        positions[displacedFile]       = originalFileIndex;
+        position->second               = index;
       }
+
+      index++;
     }
   }
 
@@ -155,10 +295,10 @@ PSArc::PSArcStatus PSArc::PSArcHandle::Downsync(PSArcSettings settings, std::fun
   // Generate new manifest file
   std::vector<byte> manifestFileBytes;
   for (auto it = sortedFiles.begin(); it != sortedFiles.end(); it++) {
-    std::string filePath = (*it)->GetPathString(settings.pathType);
-    if (std::next(it) != sortedFiles.end())
-      filePath += '\n';
+    const std::string_view filePath = (*it)->GetPathView(settings.pathType);
     manifestFileBytes.insert(manifestFileBytes.end(), filePath.begin(), filePath.end());
+    if (std::next(it) != sortedFiles.end())
+      manifestFileBytes.push_back('\n');
   }
 
   // Add the new manifest file
@@ -189,42 +329,35 @@ PSArc::PSArcStatus PSArc::PSArcHandle::Downsync(PSArcSettings settings, std::fun
 
   uint32_t blockByteCountSize = getBlockByteCountSize(settings.blockSize);
 
-  std::atomic<size_t> numFilesCompressed = 0;
-  std::atomic<size_t> numBlocks          = 0;
-
 #ifdef LIBPSARC_ENABLE_MULTITHREADING
   const size_t threadCount = std::max<size_t>(1u, std::thread::hardware_concurrency());
 #else
   const size_t threadCount = 1;
 #endif
-  {
-    std::atomic<size_t> workIndex = 0;
-    std::vector<std::thread> workers;
-    workers.reserve(threadCount);
-
-    auto workerFunc = [&] {
-      while (true) {
-        const size_t i = workIndex.fetch_add(1, std::memory_order_relaxed);
-        if (i >= files.size())
-          break;
 
-        File* file = files[i];
-
-        if (callbackFunc)
-          callbackFunc(numFilesCompressed.fetch_add(1, std::memory_order_relaxed), file->GetPathString(settings.pathType));
-
-        file->Compress(settings.compressionType, settings.blockSize);
+  // Byte identical files are compressed and written once, their TOC entries share the same data and blocks.
+  std::vector<size_t> duplicateOf(files.size());
+  if (settings.deduplicateFiles) {
+    duplicateOf = findDuplicateFiles(files, threadCount);
+  }
+  else {
+    for (size_t i = 0; i < files.size(); i++)
+      duplicateOf[i] = i;
+  }
 
-        std::vector<size_t>& fileBlockSizes = file->GetCompressedBlockSizes();
-        numBlocks.fetch_add(fileBlockSizes.size(), std::memory_order_relaxed);
-      }
-    };
+  std::unique_ptr<BlockCompressionCache> blockCache;
+  if (settings.deduplicateBlocks && settings.compressionType != CompressionType::PSARC_COMPRESSION_TYPE_NONE)
+    blockCache = std::make_unique<BlockCompressionCache>(settings.compressionType, settings.blockCacheSize);
 
-    for (size_t t = 0; t < threadCount; ++t)
-      workers.emplace_back(workerFunc);
+  // The data follows the block table, hence the number of blocks has to be known before the first file is written.
+  std::vector<size_t> fileBlockCounts(files.size(), 0);
+  size_t numBlocks = 0;
 
-    for (auto& w : workers)
-      w.join();
+  for (size_t i = 0; i < files.size(); i++) {
+    if (duplicateOf[i] == i) {
+      fileBlockCounts[i] = files[i]->GetCompressedBlockCount(settings.blockSize);
+      numBlocks += fileBlockCounts[i];
+    }
   }
 
   // tocLength field stores the total size: header (0x20) + TOC entries + block table.
@@ -244,14 +377,131 @@ PSArc::PSArcStatus PSArc::PSArcHandle::Downsync(PSArcSettings settings, std::fun
 
   this->serializationEndpoint->Seek(dataOffset);
 
-  for (File* file : files) {
+  // Files are compressed by the workers and written in TOC order by this thread as soon as they are done. Workers only start on
+  // files within the window after the file that is written next, a compressed file is released right after it was written.
+  const size_t writeWindow = (settings.writeWindow != 0) ? settings.writeWindow : 4 * threadCount;
+
+  // Large files are split into ranges of blocks, every other file is compressed as a whole by a single task. The tasks are in file
+  // order, hence the window still applies to files and the ranges of the file that is written next are always picked up first.
+  struct CompressionTask {
+    size_t file;
+    size_t range;
+    size_t firstBlock;
+    size_t blockCount;
+  };
+
+  size_t blocksPerTask = 0;
+  if (settings.compressionTaskSize != 0 && settings.blockSize != 0)
+    blocksPerTask = std::max<size_t>(1u, settings.compressionTaskSize / settings.blockSize);
+
+  std::vector<CompressionTask> tasks;
+  std::vector<std::vector<FileData>> fileRanges(files.size());
+  std::vector<std::atomic<size_t>> remainingRanges(files.size());
+
+  tasks.reserve(files.size());
+
+  for (size_t i = 0; i < files.size(); i++) {
+    const bool splitFile =
+      blocksPerTask != 0 && duplicateOf[i] == i && fileBlockCounts[i] >= 2 * blocksPerTask && files[i]->CanCompressBlockRanges();
+
+    if (!splitFile) {
+      tasks.push_back(CompressionTask {i, 0, 0, 0});
+      continue;
+    }
+
+    const size_t rangeCount = (fileBlockCounts[i] + blocksPerTask - 1) / blocksPerTask;
+    fileRanges[i].resize(rangeCount);
+    remainingRanges[i].store(rangeCount, std::memory_order_relaxed);
+
+    for (size_t range = 0; range < rangeCount; range++) {
+      const size_t firstBlock = range * blocksPerTask;
+      tasks.push_back(CompressionTask {i, range, firstBlock, std::min(blocksPerTask, fileBlockCounts[i] - firstBlock)});
+    }
+  }
+
+  std::mutex pipelineMutex;
+  std::condition_variable fileCompressed;
+  std::condition_variable fileWritten;
+  std::vector<uint8_t> compressedFiles(files.size(), 0);
+  std::atomic<size_t> nextTask = 0;
+  size_t numFilesWritten       = 0;
+  bool abortPipeline           = false;
+
+  auto compressFiles = [&] {
+    while (true) {
+      const size_t t = nextTask.fetch_add(1, std::memory_order_relaxed);
+      if (t >= tasks.size())
+        break;
+
+      const CompressionTask& task = tasks[t];
+      const size_t i              = task.file;
+      File* file                  = files[i];
+      bool fileDone               = true;
+
+      {
+        std::unique_lock<std::mutex> lock(pipelineMutex);
+        fileWritten.wait(lock, [&] { return i < numFilesWritten + writeWindow || abortPipeline; });
+
+        if (abortPipeline)
+          break;
+      }
+
+      if (task.blockCount == 0) {
+        if (duplicateOf[i] == i) {
+          file->Compress(settings.compressionType, settings.blockSize, blockCache.get());
+
+          // The uncompressed content can be read again from the source, only the compressed output is needed from here on.
+          if (file->HasSource())
+            file->ClearUncompressedBytes();
+        }
+      }
+      else {
+        // A range that could not be read stays empty, the writer reports the missing blocks as a changed block count.
+        file->CompressBlockRange(
+          settings.compressionType, settings.blockSize, task.firstBlock, task.blockCount, fileRanges[i][task.range], blockCache.get());
+
+        // Whichever task finishes the last range of a file puts the compressed state together.
+        fileDone = (remainingRanges[i].fetch_sub(1, std::memory_order_acq_rel) == 1);
+
+        if (fileDone) {
+          file->SetCompressedBlockRanges(fileRanges[i], settings.compressionType, settings.blockSize);
+          fileRanges[i].clear();
+
+          if (file->HasSource())
+            file->ClearUncompressedBytes();
+        }
+      }
+
+      if (fileDone) {
+        {
+          std::lock_guard<std::mutex> lock(pipelineMutex);
+          compressedFiles[i] = 1;
+        }
+        fileCompressed.notify_all();
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  workers.reserve(threadCount);
+
+  for (size_t t = 0; t < threadCount; t++)
+    workers.emplace_back(compressFiles);
+
+  std::vector<byte>& passthroughBuffer = GetScratchBuffer(PSARC_SCRATCH_BUFFER_STORED_BLOCK);
+  PSArcStatus status                   = PSARC_STATUS_OK;
+
+  for (size_t i = 0; i < files.size() && status == PSARC_STATUS_OK; i++) {
+    File* file = files[i];
+
+    {
+      std::unique_lock<std::mutex> lock(pipelineMutex);
+      fileCompressed.wait(lock, [&] { return compressedFiles[i] != 0; });
+    }
+
     if (callbackFunc)
       callbackFunc(tocEntries.size(), file->GetPathString(settings.pathType));
 
-    std::vector<size_t>& fileBlockSizes                          = file->GetCompressedBlockSizes();
-    const std::shared_ptr<std::vector<byte>> fileCompressedBytes = file->GetCompressedBytes();
-    size_t fileCompressedBytesSize                               = file->GetCompressedSize();
-
     TocEntry entry = TocEntry(uint32_t(blockOffset), uint64_t(file->GetUncompressedSize()), dataOffset);
 
     // Compute MD5 hash
@@ -261,7 +511,7 @@ PSArc::PSArcStatus PSArc::PSArcHandle::Downsync(PSArcSettings settings, std::fun
     }
     else {
       // Hash is computed from the file path (as ASCII bytes).
-      std::string filePath = file->GetPathString(settings.pathType);
+      const std::string_view filePath = file->GetPathView(settings.pathType);
 
       MD5Context md5Context;
       md5Init(&md5Context);
@@ -271,16 +521,69 @@ PSArc::PSArcStatus PSArc::PSArcHandle::Downsync(PSArcSettings settings, std::fun
       std::memcpy(entry.md5Hash, md5Context.digest, 16);
     }
 
-    tocEntries.push_back(entry);
+    if (duplicateOf[i] != i) {
+      // The original always comes first, hence its data has already been written.
+      entry.blockOffset = tocEntries[duplicateOf[i]].blockOffset;
+      entry.fileOffset  = tocEntries[duplicateOf[i]].fileOffset;
+      tocEntries.push_back(entry);
+    }
+    else {
+      tocEntries.push_back(entry);
+
+      const std::vector<BlockDescriptor> fileBlocks = file->GetCompressedBlocks();
+
+      if (fileBlocks.size() != fileBlockCounts[i]) {
+        std::cout << "Fatal Error in Downsync: Block count of " << file->GetPathString() << " changed during compression." << std::endl;
+        status = PSARC_STATUS_ERROR_COMPRESSION;
+      }
+      else if (file->IsCompressedSizeAvailable()) {
+        const std::shared_ptr<const std::vector<byte>> fileCompressedBytes = file->GetCompressedBytes();
 
-    this->serializationEndpoint->Write(fileCompressedBytes->data(), fileCompressedBytesSize);
-    dataOffset += fileCompressedBytesSize;
+        this->serializationEndpoint->Write(fileCompressedBytes->data(), fileCompressedBytes->size());
+        dataOffset += fileCompressedBytes->size();
+      }
+      else {
+        // Blocks of a compressed source are passed through one at a time.
+        size_t storedOffset = 0;
+        for (size_t block = 0; block < fileBlocks.size() && status == PSARC_STATUS_OK; block++) {
+          passthroughBuffer.resize(fileBlocks[block].compressedSize);
+
+          if (!file->ReadCompressedBlock(block, storedOffset, passthroughBuffer)) {
+            status = PSARC_STATUS_ERROR_ENDPOINT;
+            break;
+          }
+
+          this->serializationEndpoint->Write(passthroughBuffer.data(), passthroughBuffer.size());
+          dataOffset += passthroughBuffer.size();
+          storedOffset += passthroughBuffer.size();
+        }
+      }
 
-    for (size_t i = 0; i < fileBlockSizes.size(); i++) {
-      blockCompressedSizes[blockOffset++] = fileBlockSizes[i];
+      // Files held in memory keep their uncompressed bytes, hence at most the window's worth of compressed data is alive at a time.
+      if (file->CanClearCompressedBytes())
+        file->ClearCompressedBytes();
+
+      if (status == PSARC_STATUS_OK) {
+        for (const BlockDescriptor& block : fileBlocks) {
+          blockCompressedSizes[blockOffset++] = block.compressedSize;
+        }
+      }
     }
+
+    {
+      std::lock_guard<std::mutex> lock(pipelineMutex);
+      numFilesWritten++;
+      abortPipeline = (status != PSARC_STATUS_OK);
+    }
+    fileWritten.notify_all();
   }
 
+  for (std::thread& worker : workers)
+    worker.join();
+
+  if (status != PSARC_STATUS_OK)
+    return status;
+
   this->serializationEndpoint->Seek(0x20);
   std::vector<byte> tocBytes = std::vector<byte>(settings.tocEntrySize);
 
@@ -291,6 +594,12 @@ PSArc::PSArcStatus PSArc::PSArcHandle::Downsync(PSArcSettings settings, std::fun
 
   std::vector<byte> blockCompressedSizesBytes(blockByteCountSize * numBlocks);
 
+  // A full size block that is stored uncompressed is signalled by a block table entry of 0.
+  for (size_t i = 0; i < numBlocks; i++) {
+    if (blockCompressedSizes[i] == settings.blockSize)
+      blockCompressedSizes[i] = 0;
+  }
+
   switch (blockByteCountSize) {
     case 2:
       for (size_t i = 0; i < numBlocks; i++) {
@@ -323,6 +632,65 @@ PSArc::PSArcStatus PSArc::PSArcHandle::Downsync() {
   return this->Downsync(PSArcSettings());
 }
 
+PSArc::PSArcStatus PSArc::PSArcHandle::AnalyzeBlockDuplicates(PSArcSettings settings, BlockDuplicateReport& report) {
+  report = BlockDuplicateReport();
+
+  if (this->archiveEndpoint == nullptr) {
+    return PSARC_STATUS_ERROR_ENDPOINT;
+  }
+
+  if (settings.blockSize == 0) {
+    return PSARC_STATUS_ERROR_HEADER;
+  }
+
+  std::vector<File*> files;
+  for (File* file : *this->archiveEndpoint) {
+    if (!file->IsManifest())
+      files.push_back(file);
+  }
+
+#ifdef LIBPSARC_ENABLE_MULTITHREADING
+  const size_t threadCount = std::max<size_t>(1u, std::thread::hardware_concurrency());
+#else
+  const size_t threadCount = 1;
+#endif
+
+  // Files of a parsed archive read their stored data one at a time through the shared endpoint, decompressing and fingerprinting
+  // runs concurrently.
+  std::vector<std::vector<BlockFingerprint>> fileFingerprints(files.size());
+  forEachParallel(files.size(), threadCount, [&](size_t i) {
+    const std::shared_ptr<const std::vector<byte>> content = files[i]->GetUncompressedBytes();
+    const size_t blockCount                                = GetBlockCount(content->size(), settings.blockSize);
+
+    fileFingerprints[i].reserve(blockCount);
+    for (size_t block = 0; block < blockCount; block++) {
+      const size_t blockSize = GetUncompressedBlockSize(block, content->size(), settings.blockSize);
+      fileFingerprints[i].push_back(BlockCompressionCache::Fingerprint({content->data() + block * settings.blockSize, blockSize}));
+    }
+
+    if (files[i]->HasSource()) {
+      files[i]->ClearUncompressedBytes();
+      files[i]->ClearCompressedBytes();
+    }
+  });
+
+  std::unordered_set<BlockFingerprint, BlockFingerprintHash> seenBlocks;
+  for (size_t i = 0; i < files.size(); i++) {
+    const size_t fileSize = files[i]->GetUncompressedSize();
+
+    for (size_t block = 0; block < fileFingerprints[i].size(); block++) {
+      report.totalBlocks++;
+
+      if (!seenBlocks.insert(fileFingerprints[i][block]).second) {
+        report.duplicateBlocks++;
+        report.duplicateBytes += GetUncompressedBlockSize(block, fileSize, settings.blockSize);
+      }
+    }
+  }
+
+  return PSARC_STATUS_OK;
+}
+
 PSArc::PSArcStatus PSArc::PSArcHandle::Upsync() {
   if (this->parsingEndpoint == nullptr) {
     return PSARC_STATUS_ERROR_ENDPOINT;
@@ -377,30 +745,48 @@ PSArc::PSArcStatus PSArc::PSArcHandle::Upsync() {
   uint32_t blockByteCountSize = getBlockByteCountSize(blockSize);
   uint32_t numBlocks          = (tocActualLength - tocEntrySize * tocEntriesCount) / blockByteCountSize;
 
-  this->blocks = new size_t[numBlocks];
+  std::vector<uint32_t> blockSizes(numBlocks);
   switch (blockByteCountSize) {
     case 2:
       for (uint32_t i = 0; i < numBlocks; i++) {
-        this->blocks[i] = readScalar<uint16_t>(toc.data(), tocEntrySize * tocEntriesCount + i * blockByteCountSize, endianMismatch);
+        blockSizes[i] = readScalar<uint16_t>(toc.data(), tocEntrySize * tocEntriesCount + i * blockByteCountSize, endianMismatch);
       }
       break;
     case 3:
       for (uint32_t i = 0; i < numBlocks; i++) {
-        this->blocks[i] = readScalar<uint24_t>(toc.data(), tocEntrySize * tocEntriesCount + i * blockByteCountSize, endianMismatch);
+        blockSizes[i] = readScalar<uint24_t>(toc.data(), tocEntrySize * tocEntriesCount + i * blockByteCountSize, endianMismatch);
       }
       break;
     case 4:
       for (uint32_t i = 0; i < numBlocks; i++) {
-        this->blocks[i] = readScalar<uint32_t>(toc.data(), tocEntrySize * tocEntriesCount + i * blockByteCountSize, endianMismatch);
+        blockSizes[i] = readScalar<uint32_t>(toc.data(), tocEntrySize * tocEntriesCount + i * blockByteCountSize, endianMismatch);
       }
       break;
   }
 
   // Blocks of size 0 are actually maximum block size
   for (uint32_t i = 0; i < numBlocks; i++) {
-    this->blocks[i] = (this->blocks[i] > 0) ? this->blocks[i] : blockSize;
+    blockSizes[i] = (blockSizes[i] > 0) ? blockSizes[i] : blockSize;
+  }
+
+  // A block descriptor only has 31 bits for the size.
+  if (std::any_of(blockSizes.begin(), blockSizes.end(), [](uint32_t size) { return size > 0x7FFFFFFF; }))
+    return PSARC_STATUS_ERROR_HEADER;
+
+  if (this->blocks != nullptr)
+    delete[] this->blocks;
+
+  this->blocks = new BlockDescriptor[numBlocks];
+  for (uint32_t i = 0; i < numBlocks; i++) {
+    this->blocks[i] = BlockDescriptor {blockSizes[i], 0};
   }
 
+  if (!classifyBlocks(tocEntries, this->blocks, numBlocks, this->blockSize, this->compressionType))
+    return PSARC_STATUS_ERROR_HEADER;
+
+  if (tocEntries.empty())
+    return PSARC_STATUS_ERROR_MANIFEST;
+
   TocEntry manifest = tocEntries[0];
 
   if (manifest.uncompressedSize == 0)
@@ -408,25 +794,28 @@ PSArc::PSArcStatus PSArc::PSArcHandle::Upsync() {
 
   this->parsingEndpoint->Seek(manifest.fileOffset);
 
-  PSArc::PSArcFile* manifestFileSource = new PSArcFile(*this, manifest, this->compressionType);
+  std::shared_ptr<PSArcFile> manifestFileSource = std::make_shared<PSArcFile>(*this, manifest, this->compressionType);
   this->archiveEndpoint->AddFile(PSArc::File(std::string("PSArcManifest.bin"), manifestFileSource));
 
   PSArc::File* manifestFile = this->archiveEndpoint->FindFile("PSArcManifest.bin", this->pathType);
 
   if (manifestFile != nullptr) {
-    const std::shared_ptr<std::vector<byte>> manifestBytes = manifestFile->GetUncompressedBytes();
+    const std::shared_ptr<const std::vector<byte>> manifestBytes = manifestFile->GetUncompressedBytes();
 
     std::string fileNames                        = std::string(manifestBytes->begin(), manifestBytes->end());
     const std::vector<std::string> listFileNames = GetStringsFromManifest(fileNames);
 
+    std::vector<PSArc::File> files;
+    files.reserve(tocEntries.size() - 1);
+
     for (uint32_t i = 1; i < tocEntries.size(); i++) {
       const std::string& fileName  = listFileNames[i - 1];
-      PSArc::PSArcFile* fileSource = new PSArcFile(*this, tocEntries[i], this->compressionType);
-      PSArc::File file(fileName, fileSource);
+      std::shared_ptr<PSArcFile> fileSource = std::make_shared<PSArcFile>(*this, tocEntries[i], this->compressionType);
+      files.emplace_back(fileName, std::move(fileSource));
+    }
 
-      if (!this->archiveEndpoint->AddFile(file)) {
-        return PSARC_STATUS_ERROR_INSERT;
-      }
+    if (!this->archiveEndpoint->AddFiles(std::move(files))) {
+      return PSARC_STATUS_ERROR_INSERT;
     }
   }
 
@@ -438,59 +827,81 @@ PSArc::FileData PSArc::PSArcFile::GetData() {
     return FileData{};
   }
 
-  uint64_t uncompressedSize = this->entry.uncompressedSize;
-  uint64_t uncompressedRead = 0;
-  uint32_t blockOffset      = this->entry.blockOffset;
-  uint64_t outputOffset     = 0;
-  size_t blockSize          = this->psarcHandle.blockSize;
-  size_t outputSize         = 0;
+  const size_t blockSize  = this->psarcHandle.blockSize;
+  const size_t blockCount = GetBlockCount();
 
   FileData output;
   output.uncompressedTotalSize    = this->entry.uncompressedSize;
   output.compressionType          = this->psarcHandle.compressionType;
-  output.uncompressedMaxBlockSize = this->psarcHandle.blockSize;
-  output.compressedMaxBlockSize   = this->psarcHandle.blockSize;
+  output.uncompressedMaxBlockSize = blockSize;
+  output.compressedMaxBlockSize   = blockSize;
 
-  this->psarcHandle.parsingEndpoint->Seek(this->entry.fileOffset);
+  // The block classification was computed and validated during Upsync, no need to look at the data itself.
+  const BlockDescriptor* fileBlocks = this->psarcHandle.blocks + this->entry.blockOffset;
+  output.blocks.assign(fileBlocks, fileBlocks + blockCount);
 
-  do {
-    size_t entrySize = this->psarcHandle.blocks[blockOffset];
+  size_t compressedTotalSize = 0;
+  for (const BlockDescriptor& block : output.blocks) {
+    compressedTotalSize += block.compressedSize;
+  }
 
-    outputSize += entrySize;
-    output.bytes.resize(outputSize);
+  // The blocks of a file are stored contiguously, hence they can be read all at once.
+  output.bytes = BufferPool::Get().Acquire(compressedTotalSize);
+  output.bytes.resize(compressedTotalSize);
 
-    uint64_t maxPossibleUncompressedSize = std::min((uint64_t) blockSize, uncompressedSize - uncompressedRead);
+  {
+    std::lock_guard<std::mutex> lock(this->psarcHandle.parsingMutex);
+    this->psarcHandle.parsingEndpoint->Seek(this->entry.fileOffset);
+    this->psarcHandle.parsingEndpoint->Read(output.bytes.data(), compressedTotalSize);
+  }
 
-    this->psarcHandle.parsingEndpoint->Read(output.bytes.data() + outputOffset, entrySize);
+  return output;
+}
 
-    bool blockIsCompressed;
-    switch (this->psarcHandle.compressionType) {
-      case CompressionType::PSARC_COMPRESSION_TYPE_LZMA:
-        // LZMA has no real magic, 0x5d and 0x2c are the most common first bytes of LZMA props.
-        // Another heuristic is to make sure that the data is actually smaller than the uncompressed part.
-        // However, sometimes compression may lead to no reduction in size which would cause a fail here aswell.
-        blockIsCompressed = (output.bytes.data()[outputOffset] == 0x5d || output.bytes.data()[outputOffset] == 0x2c)
-                            && entrySize != maxPossibleUncompressedSize;
-        break;
-      case CompressionType::PSARC_COMPRESSION_TYPE_ZLIB: {
-        uint16_t zlib_magic = readScalar<uint16_t>(output.bytes.data(), outputOffset);
-        blockIsCompressed   = zlib_magic == 0x78da || zlib_magic == 0xda78 || zlib_magic == 0x789c || zlib_magic == 0x9c78
-                              || zlib_magic == 0x7801 || zlib_magic == 0x0178;
-      } break;
-      default:
-        blockIsCompressed = false;
-        break;
-    }
-    output.blockIsCompressed.emplace_back(blockIsCompressed);
+size_t PSArc::PSArcFile::GetBlockCount() {
+  return PSArc::GetBlockCount(this->entry.uncompressedSize, this->psarcHandle.blockSize);
+}
 
-    outputOffset += entrySize;
-    output.compressedBlockSizes.emplace_back(entrySize);
+size_t PSArc::PSArcFile::GetMaxBlockSize() {
+  return this->psarcHandle.blockSize;
+}
 
-    uncompressedRead += blockSize;
-    blockOffset++;
-  } while (uncompressedRead < uncompressedSize);
+PSArc::BlockDescriptor PSArc::PSArcFile::GetBlockDescriptor(size_t index) {
+  return this->psarcHandle.blocks[this->entry.blockOffset + index];
+}
 
-  return output;
+bool PSArc::PSArcFile::ReadBlock(size_t index, std::span<byte> dst) {
+  if (this->psarcHandle.parsingEndpoint == nullptr || index >= GetBlockCount() || dst.size() != GetBlockDescriptor(index).compressedSize)
+    return false;
+
+  // The read position below and the endpoint are shared with the other threads reading this archive.
+  std::lock_guard<std::mutex> lock(this->psarcHandle.parsingMutex);
+
+  // Blocks are usually read in order, continue from the previous block instead of summing up all preceding block sizes.
+  if (index < this->nextBlockIndex) {
+    this->nextBlockIndex  = 0;
+    this->nextBlockOffset = this->entry.fileOffset;
+  }
+
+  for (; this->nextBlockIndex < index; this->nextBlockIndex++) {
+    this->nextBlockOffset += GetBlockDescriptor(this->nextBlockIndex).compressedSize;
+  }
+
+  this->psarcHandle.parsingEndpoint->Seek(this->nextBlockOffset);
+  if (!this->psarcHandle.parsingEndpoint->Read(dst.data(), dst.size()))
+    return false;
+
+  this->nextBlockIndex++;
+  this->nextBlockOffset += dst.size();
+  return true;
+}
+
+bool PSArc::PSArcFile::SupportsBlockAccess() {
+  return true;
+}
+
+bool PSArc::PSArcFile::SupportsConcurrentReads() {
+  return true;
 }
 
 PSArc::CompressionType PSArc::PSArcFile::GetCompressionType() {
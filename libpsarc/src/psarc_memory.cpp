@@ -1,5 +1,8 @@
 #include "psarc_memory.hpp"
 
+#include <array>
+#include <bit>
+
 static std::ios::seekdir SeekTypeToSeekDir(PSArc::SeekType type) {
   switch (type) {
     case PSArc::SeekType::PSARC_SEEK_TYPE_START:
@@ -63,3 +66,106 @@ bool PSArc::FileHandle::Write(const byte* buf, size_t bytes_to_write) {
 
   return true;
 }
+
+/* The size class of a buffer with the given capacity, see BufferPool. */
+static size_t getSizeClass(size_t capacity) {
+  return (capacity == 0) ? 0 : size_t(std::bit_width(capacity)) - 1;
+}
+
+std::vector<byte> PSArc::BufferPool::TakeFrom(size_t sizeClass) {
+  std::vector<std::vector<byte>>& buffers = this->sizeClasses[sizeClass];
+
+  std::vector<byte> buffer = std::move(buffers.back());
+  buffers.pop_back();
+
+  if (buffers.empty())
+    this->nonEmptyClasses &= ~(uint64_t(1) << sizeClass);
+
+  this->pooledBytes -= buffer.capacity();
+  return buffer;
+}
+
+std::vector<byte> PSArc::BufferPool::Acquire(size_t minCapacity) {
+  std::vector<byte> buffer;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    // Buffers of the size class of minCapacity may be too small, only the most recently released one is checked. Every buffer of
+    // a larger class fits, the smallest non empty one of the next few classes is taken. Larger buffers are left to requests they
+    // suit better, a small request allocates instead of pinning a large buffer.
+    const size_t sizeClass                           = getSizeClass(minCapacity);
+    const std::vector<std::vector<byte>>& candidates = this->sizeClasses[sizeClass];
+
+    if (!candidates.empty() && candidates.back().capacity() >= minCapacity) {
+      buffer = TakeFrom(sizeClass);
+    }
+    else if (sizeClass + 1 < SIZE_CLASS_COUNT) {
+      const uint64_t largerClasses = this->nonEmptyClasses & (((uint64_t(1) << MAX_LARGER_SIZE_CLASSES) - 1) << (sizeClass + 1));
+      if (largerClasses != 0)
+        buffer = TakeFrom(size_t(std::countr_zero(largerClasses)));
+    }
+  }
+
+  buffer.clear();
+  buffer.reserve(minCapacity);
+  return buffer;
+}
+
+void PSArc::BufferPool::Release(std::vector<byte>&& buffer) {
+  const size_t capacity = buffer.capacity();
+  if (capacity == 0)
+    return;
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (capacity > this->maxBufferSize || this->pooledBytes + capacity > this->maxPooledBytes)
+    return;
+
+  const size_t sizeClass = getSizeClass(capacity);
+
+  this->pooledBytes += capacity;
+  this->sizeClasses[sizeClass].push_back(std::move(buffer));
+  this->nonEmptyClasses |= uint64_t(1) << sizeClass;
+}
+
+void PSArc::BufferPool::Trim() {
+  // Only called when the limits change, hence a pass over all pooled buffers is fine here.
+  for (size_t sizeClass = SIZE_CLASS_COUNT; sizeClass-- > 0;) {
+    std::vector<std::vector<byte>>& buffers = this->sizeClasses[sizeClass];
+
+    for (size_t i = buffers.size(); i-- > 0;) {
+      if (this->pooledBytes <= this->maxPooledBytes && buffers[i].capacity() <= this->maxBufferSize)
+        continue;
+
+      this->pooledBytes -= buffers[i].capacity();
+      std::swap(buffers[i], buffers.back());
+      buffers.pop_back();
+    }
+
+    if (buffers.empty())
+      this->nonEmptyClasses &= ~(uint64_t(1) << sizeClass);
+  }
+}
+
+void PSArc::BufferPool::SetLimits(size_t _maxPooledBytes, size_t _maxBufferSize) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->maxPooledBytes = _maxPooledBytes;
+  this->maxBufferSize  = _maxBufferSize;
+
+  Trim();
+}
+
+size_t PSArc::BufferPool::GetPooledBytes() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->pooledBytes;
+}
+
+PSArc::BufferPool& PSArc::BufferPool::Get() {
+  // Intentionally never destroyed, file data in static objects may still release its buffer during shutdown.
+  static BufferPool* pool = new BufferPool(DEFAULT_MAX_POOLED_BYTES, DEFAULT_MAX_BUFFER_SIZE);
+  return *pool;
+}
+
+std::vector<byte>& PSArc::GetScratchBuffer(ScratchBuffer buffer) {
+  thread_local std::array<std::vector<byte>, PSARC_SCRATCH_BUFFER_COUNT> scratchBuffers;
+  return scratchBuffers[buffer];
+}
@@ -0,0 +1,247 @@
+#include "psarc_path_index.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+static void writeVarint(std::vector<char>& dst, size_t value) {
+  while (value >= 0x80) {
+    dst.push_back(char((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+
+  dst.push_back(char(value));
+}
+
+static size_t readVarint(const std::vector<char>& src, size_t& offset) {
+  size_t value = 0;
+  size_t shift = 0;
+
+  while (true) {
+    const unsigned char current = static_cast<unsigned char>(src[offset++]);
+    value |= size_t(current & 0x7F) << shift;
+
+    if ((current & 0x80) == 0)
+      return value;
+
+    shift += 7;
+  }
+}
+
+static std::string_view stripLeadingSlash(std::string_view path) {
+  if (!path.empty() && path.front() == '/')
+    path.remove_prefix(1);
+
+  return path;
+}
+
+/* Returns the pattern position after the token at position, "**" is a single token. */
+static size_t nextGlobToken(std::string_view pattern, size_t position) {
+  return pattern.substr(position).starts_with("**") ? position + 2 : position + 1;
+}
+
+/*
+ * Activates the positions after '*' and "**" tokens, which may match nothing. A "**" component may also match no directory at
+ * all, hence the position after its trailing separator is activated as well. Tokens only lead forward, one pass suffices.
+ */
+static void addEmptyGlobMatches(std::string_view pattern, std::vector<uint8_t>& states) {
+  for (size_t position = 0; position < pattern.size(); position++) {
+    if (!states[position] || pattern[position] != '*')
+      continue;
+
+    states[nextGlobToken(pattern, position)] = 1;
+
+    if (pattern.substr(position).starts_with("**/") && (position == 0 || pattern[position - 1] == '/'))
+      states[position + 3] = 1;
+  }
+}
+
+/*
+ * Tracks every pattern position the path matched so far can end at, one path character at a time. Unlike backtracking this takes
+ * O(path length * pattern length) for any pattern. The state vectors are passed in to reuse them across calls.
+ */
+static bool matchesGlob(std::string_view path, std::string_view pattern, std::vector<uint8_t>& current, std::vector<uint8_t>& next) {
+  current.assign(pattern.size() + 1, 0);
+  next.assign(pattern.size() + 1, 0);
+
+  current[0] = 1;
+  addEmptyGlobMatches(pattern, current);
+
+  for (const char c : path) {
+    std::fill(next.begin(), next.end(), 0);
+    bool anyState = false;
+
+    for (size_t position = 0; position < pattern.size(); position++) {
+      if (!current[position])
+        continue;
+
+      if (pattern.substr(position).starts_with("**")) {
+        next[position] = 1;
+        anyState       = true;
+      }
+      else if (pattern[position] == '*') {
+        if (c != '/') {
+          next[position] = 1;
+          anyState       = true;
+        }
+      }
+      else if (pattern[position] == '?' ? c != '/' : pattern[position] == c) {
+        next[position + 1] = 1;
+        anyState           = true;
+      }
+    }
+
+    if (!anyState)
+      return false;
+
+    addEmptyGlobMatches(pattern, next);
+    std::swap(current, next);
+  }
+
+  return current[pattern.size()] != 0;
+}
+
+PSArc::PathIndex::Cursor::Cursor(const PathIndex* _index, size_t block) : index(_index), entry(_index->files.size()), offset(0), path() {
+  if (block < this->index->blockOffsets.size()) {
+    this->entry  = block * BLOCK_ENTRY_COUNT;
+    this->offset = this->index->blockOffsets[block];
+    Decode();
+  }
+}
+
+void PSArc::PathIndex::Cursor::Next() {
+  this->entry++;
+  Decode();
+}
+
+void PSArc::PathIndex::Cursor::Decode() {
+  if (!IsValid())
+    return;
+
+  const size_t sharedLength = readVarint(this->index->encodedPaths, this->offset);
+  const size_t suffixLength = readVarint(this->index->encodedPaths, this->offset);
+
+  this->path.resize(sharedLength);
+  this->path.append(this->index->encodedPaths.data() + this->offset, suffixLength);
+  this->offset += suffixLength;
+}
+
+std::string_view PSArc::PathIndex::GetBlockHead(size_t block) const {
+  // The first entry of a block shares nothing with its predecessor, hence its suffix is the whole path.
+  size_t offset = this->blockOffsets[block];
+  readVarint(this->encodedPaths, offset);
+  const size_t length = readVarint(this->encodedPaths, offset);
+
+  return std::string_view(this->encodedPaths.data() + offset, length);
+}
+
+PSArc::PathIndex::Cursor PSArc::PathIndex::LowerBound(std::string_view path) const {
+  // Find the last block whose first path is not greater than path, the lower bound is either in that block or the next one.
+  size_t low  = 0;
+  size_t high = this->blockOffsets.size();
+
+  while (low < high) {
+    const size_t middle = low + (high - low) / 2;
+
+    if (GetBlockHead(middle) <= path)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  Cursor cursor(this, (low == 0) ? 0 : low - 1);
+  while (cursor.IsValid() && std::string_view(cursor.GetPath()) < path) {
+    cursor.Next();
+  }
+
+  return cursor;
+}
+
+void PSArc::PathIndex::Build(std::vector<std::pair<std::string, File*>> entries) {
+  Clear();
+
+  for (std::pair<std::string, File*>& entry : entries) {
+    if (!entry.first.empty() && entry.first.front() == '/')
+      entry.first.erase(0, 1);
+  }
+
+  std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  this->files.reserve(entries.size());
+  this->blockOffsets.reserve((entries.size() + BLOCK_ENTRY_COUNT - 1) / BLOCK_ENTRY_COUNT);
+
+  std::string_view previous;
+  for (size_t i = 0; i < entries.size(); i++) {
+    const std::string_view path = entries[i].first;
+    size_t sharedLength         = 0;
+
+    if (i % BLOCK_ENTRY_COUNT == 0) {
+      this->blockOffsets.push_back(this->encodedPaths.size());
+    }
+    else {
+      const size_t maxLength = std::min(previous.size(), path.size());
+      while (sharedLength < maxLength && previous[sharedLength] == path[sharedLength]) {
+        sharedLength++;
+      }
+    }
+
+    writeVarint(this->encodedPaths, sharedLength);
+    writeVarint(this->encodedPaths, path.size() - sharedLength);
+    this->encodedPaths.insert(this->encodedPaths.end(), path.begin() + sharedLength, path.end());
+
+    this->files.push_back(entries[i].second);
+    previous = path;
+  }
+
+  this->encodedPaths.shrink_to_fit();
+}
+
+void PSArc::PathIndex::Clear() noexcept {
+  this->encodedPaths.clear();
+  this->blockOffsets.clear();
+  this->files.clear();
+}
+
+PSArc::File* PSArc::PathIndex::Find(std::string_view path) const {
+  path = stripLeadingSlash(path);
+
+  const Cursor cursor = LowerBound(path);
+  if (!cursor.IsValid() || cursor.GetPath() != path)
+    return nullptr;
+
+  return cursor.GetFile();
+}
+
+std::vector<PSArc::File*> PSArc::PathIndex::FindWithPrefix(std::string_view prefix) const {
+  prefix = stripLeadingSlash(prefix);
+
+  std::vector<File*> result;
+  for (Cursor cursor = LowerBound(prefix); cursor.IsValid() && cursor.GetPath().starts_with(prefix); cursor.Next()) {
+    result.push_back(cursor.GetFile());
+  }
+
+  return result;
+}
+
+std::vector<PSArc::File*> PSArc::PathIndex::FindMatching(std::string_view pattern) const {
+  pattern = stripLeadingSlash(pattern);
+
+  // Only paths starting with the literal part of the pattern can match, which limits the search to a range of the index.
+  const std::string_view prefix = pattern.substr(0, std::min(pattern.find_first_of("*?"), pattern.size()));
+
+  std::vector<uint8_t> current;
+  std::vector<uint8_t> next;
+
+  std::vector<File*> result;
+  for (Cursor cursor = LowerBound(prefix); cursor.IsValid() && cursor.GetPath().starts_with(prefix); cursor.Next()) {
+    if (matchesGlob(cursor.GetPath(), pattern, current, next))
+      result.push_back(cursor.GetFile());
+  }
+
+  return result;
+}
+
+bool PSArc::PathIndex::MatchesGlob(std::string_view path, std::string_view pattern) {
+  std::vector<uint8_t> current;
+  std::vector<uint8_t> next;
+  return matchesGlob(path, pattern, current, next);
+}
@@ -0,0 +1,75 @@
+#include <iostream>
+#include <string>
+
+#include "psarc.hpp"
+
+static const char* diffStatusToString(PSArc::FileDiffStatus status) {
+  switch (status) {
+    case PSArc::FileDiffStatus::PSARC_FILE_DIFF_STATUS_ADDED:
+      return "+ ";
+    case PSArc::FileDiffStatus::PSARC_FILE_DIFF_STATUS_REMOVED:
+      return "- ";
+    case PSArc::FileDiffStatus::PSARC_FILE_DIFF_STATUS_CHANGED:
+      return "~ ";
+    default:
+      return "  ";
+  }
+}
+
+int DiffPSArc(std::string& oldInput, std::string& newInput) {
+  PSArc::FileHandle oldFileHandle(oldInput);
+  PSArc::FileHandle newFileHandle(newInput);
+
+  if (!oldFileHandle.IsValid()) {
+    std::cout << "Failed to open file: " << oldInput << std::endl;
+    return -1;
+  }
+
+  if (!newFileHandle.IsValid()) {
+    std::cout << "Failed to open file: " << newInput << std::endl;
+    return -1;
+  }
+
+  PSArc::PSArcHandle oldHandle;
+  PSArc::PSArcHandle newHandle;
+  PSArc::Archive oldArchive;
+  PSArc::Archive newArchive;
+
+  oldHandle.SetParsingEndpoint(&oldFileHandle);
+  oldHandle.SetArchive(&oldArchive);
+  newHandle.SetParsingEndpoint(&newFileHandle);
+  newHandle.SetArchive(&newArchive);
+
+  for (PSArc::PSArcHandle* handle : {&oldHandle, &newHandle}) {
+    PSArc::PSArcStatus upsyncStatus = handle->Upsync();
+
+    if (upsyncStatus != PSArc::PSARC_STATUS_OK) {
+      std::cout << "Failed to synchronize with source archive." << std::endl;
+      std::cout << "Error: " << PSArc::PSArcStatusToString(upsyncStatus) << std::endl;
+      return -1;
+    }
+  }
+
+  if (oldHandle.compressionType != newHandle.compressionType || oldHandle.blockSize != newHandle.blockSize) {
+    std::cout << "Warning: the archives use different compression settings, unchanged files may be reported as changed." << std::endl;
+  }
+
+  PSArc::ArchiveDiff diff;
+  PSArc::PSArcStatus diffStatus = PSArc::DiffArchives(oldArchive, newArchive, diff);
+
+  if (diffStatus != PSArc::PSARC_STATUS_OK) {
+    std::cout << "Failed to compare archives." << std::endl;
+    std::cout << "Error: " << PSArc::PSArcStatusToString(diffStatus) << std::endl;
+    return -1;
+  }
+
+  for (const PSArc::FileDiff& file : diff.files) {
+    if (file.status != PSArc::FileDiffStatus::PSARC_FILE_DIFF_STATUS_UNCHANGED)
+      std::cout << diffStatusToString(file.status) << file.path << std::endl;
+  }
+
+  std::cout << diff.addedCount << " added, " << diff.removedCount << " removed, " << diff.changedCount << " changed, " << diff.unchangedCount
+            << " unchanged" << std::endl;
+
+  return 0;
+}
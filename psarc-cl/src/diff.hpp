@@ -0,0 +1,5 @@
+#pragma once
+
+#include <string>
+
+int DiffPSArc(std::string& oldInput, std::string& newInput);
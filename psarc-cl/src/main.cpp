@@ -2,6 +2,7 @@
 #include <iostream>
 
 #include "config.hpp"
+#include "diff.hpp"
 #include "pack.hpp"
 #include "psarc.hpp"
 #include "unpack.hpp"
@@ -26,6 +27,7 @@ int main(int argc, char* argv[]) {
     std::cout << "MODE:" << std::endl;
     std::cout << "  pack      Pack all files in a directory into a PSArc file." << std::endl;
     std::cout << "  unpack    Unpack all files in a PSArc file into a directory." << std::endl;
+    std::cout << "  diff      List the files added, removed or changed between two PSArc files." << std::endl;
     return -1;
   }
 
@@ -35,6 +37,7 @@ int main(int argc, char* argv[]) {
 
   bool isPackMode   = modeString.compare("pack") == 0;
   bool isUnpackMode = modeString.compare("unpack") == 0;
+  bool isDiffMode   = modeString.compare("diff") == 0;
 
   if (isPackMode) {
     return PackPSArc(inputString, outputString);
@@ -42,8 +45,11 @@ int main(int argc, char* argv[]) {
   else if (isUnpackMode) {
     return UnpackPSArc(inputString, outputString);
   }
+  else if (isDiffMode) {
+    return DiffPSArc(inputString, outputString);
+  }
   else {
-    std::cout << "No valid mode was specified (pack or unpack)" << std::endl;
+    std::cout << "No valid mode was specified (pack, unpack or diff)" << std::endl;
     return -1;
   }
 }
@@ -1,7 +1,12 @@
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "psarc.hpp"
 
@@ -60,6 +65,12 @@ static PSArc::PSArcSettings LoadSettingsFromFile(const std::filesystem::path& se
       else
         settings.endianness = std::endian::native;
     }
+    else if (key == "deduplicateFiles") {
+      settings.deduplicateFiles = (value == "true");
+    }
+    else if (key == "deduplicateBlocks") {
+      settings.deduplicateBlocks = (value == "true");
+    }
   }
 
   return settings;
@@ -96,7 +107,8 @@ int PackPSArc(std::string& input, std::string& output) {
   // end of iterator is defined as a default constructed one
   static std::filesystem::recursive_directory_iterator end;
 
-  size_t currentFileNumber = 0;
+  // Walking the tree is serial, the files found are checked and staged into the archive by several threads.
+  std::vector<std::filesystem::path> filePaths;
 
   while (fileIterator != end) {
     std::filesystem::path filePath = fileIterator->path();
@@ -108,32 +120,57 @@ int PackPSArc(std::string& input, std::string& output) {
     if (filePath.filename() == k_SettingsFileName)
       continue;
 
-    PSArc::FileHandle fileHandle(filePath);
+    filePaths.push_back(std::move(filePath));
+  }
+
+  const size_t totalFileCount = filePaths.size();
+  std::atomic<size_t> nextFile  = 0;
+  std::atomic<size_t> numStaged = 0;
+  // Only guards the console, the counters are updated without it.
+  std::mutex outputMutex;
 
-    if (fileHandle.IsValid()) {
-      std::cout << RESET_LINE "[" << currentFileNumber << "] " << filePath.generic_string();
+  auto stageFiles = [&]() {
+    while (true) {
+      const size_t i = nextFile.fetch_add(1, std::memory_order_relaxed);
+      if (i >= filePaths.size())
+        break;
 
-      std::uintmax_t fileSize = std::filesystem::file_size(filePath);
+      const std::filesystem::path& filePath = filePaths[i];
 
-      std::filesystem::path relativeFilePath = std::filesystem::relative(filePath, inputPath);
+      // The content is only read once the file is compressed during Downsync.
+      std::shared_ptr<PSArc::LooseFileSource> fileSource = std::make_shared<PSArc::LooseFileSource>(filePath);
 
-      std::vector<byte> bytes(fileSize);
-      fileHandle.Read(bytes.data(), fileSize);
+      if (fileSource->IsValid()) {
+        std::filesystem::path relativeFilePath = std::filesystem::relative(filePath, inputPath);
+        archive.StageFile(PSArc::File(relativeFilePath.generic_string(), std::move(fileSource)));
+        const size_t staged = numStaged.fetch_add(1, std::memory_order_relaxed) + 1;
 
-      PSArc::File file(relativeFilePath.generic_string(), bytes);
-      archive.AddFile(file);
-    }
-    else {
-      std::cout << RESET_LINE << "Failed to read file: " << filePath.generic_string() << std::endl;
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cout << RESET_LINE "[" << staged << "/" << totalFileCount << "] " << filePath.generic_string();
+      }
+      else {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cout << RESET_LINE << "Failed to read file: " << filePath.generic_string() << std::endl;
+      }
     }
+  };
 
-    currentFileNumber++;
-  }
+  const size_t threadCount = std::min<size_t>(std::max<size_t>(1u, std::thread::hardware_concurrency()), filePaths.size());
+  std::vector<std::thread> workers;
+  workers.reserve(threadCount);
+
+  for (size_t t = 0; t < threadCount; t++)
+    workers.emplace_back(stageFiles);
+
+  for (std::thread& worker : workers)
+    worker.join();
+
+  archive.CommitStagedFiles();
 
   std::cout << RESET_LINE "Packing files into: " << outputPath.generic_string() << std::endl;
-  PSArc::PSArcStatus status = handle.Downsync(settings, [currentFileNumber](size_t numFilesPacked, std::string name) -> void {
+  PSArc::PSArcStatus status = handle.Downsync(settings, [totalFileCount](size_t numFilesPacked, std::string name) -> void {
     std::stringstream msg;
-    msg << RESET_LINE "[" << numFilesPacked << "/" << currentFileNumber << "] " << name;
+    msg << RESET_LINE "[" << numFilesPacked << "/" << totalFileCount << "] " << name;
     std::cout << msg.str();
   });
 
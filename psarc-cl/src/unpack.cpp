@@ -90,16 +90,31 @@ int UnpackPSArc(std::string& input, std::string& output) {
   // We cannot parallelize this. All PSArcFile sources share a single parsingEndpoint
   // (the input FileHandle) which is not thread-safe for concurrent Seek/Read.
 
-  std::for_each(archive.begin(), archive.end(), [outputPath, fileCount, &currentFileNumber](PSArc::File* file) {
-    std::filesystem::path fileOutputPath(outputPath);
-    fileOutputPath += file->path.relative_path();
+  // Files are decompressed block by block into this buffer, it only ever grows to the size of the largest block.
+  std::vector<byte> blockBuffer;
+
+  std::for_each(archive.begin(), archive.end(), [outputPath, fileCount, &currentFileNumber, &blockBuffer](PSArc::File* file) {
+    std::filesystem::path fileOutputPath = outputPath / file->path.relative_path();
 
     PSArc::FileHandle fileOutputHandle(fileOutputPath, true);
 
     if (fileOutputHandle.IsValid()) {
       std::cout << RESET_LINE "[" << currentFileNumber << "/" << fileCount << "] " << file->path.generic_string();
 
-      fileOutputHandle.Write(file->GetUncompressedBytes()->data(), file->GetUncompressedSize());
+      const size_t fileSize     = file->GetUncompressedSize();
+      const size_t blockCount   = file->GetBlockCount();
+      const size_t maxBlockSize = file->GetMaxBlockSize();
+
+      for (size_t block = 0; block < blockCount; block++) {
+        blockBuffer.resize(PSArc::GetUncompressedBlockSize(block, fileSize, maxBlockSize));
+
+        if (!file->DecompressInto(blockBuffer, block, 1)) {
+          std::cout << RESET_LINE << "Failed to decompress file " << file->path.generic_string() << std::endl;
+          break;
+        }
+
+        fileOutputHandle.Write(blockBuffer.data(), blockBuffer.size());
+      }
     }
     else {
       std::cout << RESET_LINE << "Failed to write file " << file->path.generic_string() << std::endl;
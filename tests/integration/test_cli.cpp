@@ -102,6 +102,45 @@ TEST(CliRoundTrip, FixturesPackAndUnpack) {
   EXPECT_TRUE(diff.empty()) << diff;
 }
 
+// ---------------------------------------------------------------------------
+// Diff of two archives using the CLI binary
+// ---------------------------------------------------------------------------
+
+TEST(CliDiff, ReportsChangedFiles) {
+  const fs::path cli(PSARC_CLI_BINARY_PATH);
+  ASSERT_TRUE(fs::exists(cli));
+
+  TempDir workDir("diff");
+  fs::path oldDir = workDir.path / "old";
+  fs::path newDir = workDir.path / "new";
+  fs::create_directories(oldDir / "sub");
+  fs::create_directories(newDir / "sub");
+
+  std::ofstream(oldDir / "same.txt") << "same";
+  std::ofstream(newDir / "same.txt") << "same";
+  std::ofstream(oldDir / "sub" / "changed.txt") << "old content";
+  std::ofstream(newDir / "sub" / "changed.txt") << "new content, longer";
+  std::ofstream(oldDir / "removed.txt") << "removed";
+  std::ofstream(newDir / "added.txt") << "added";
+
+  fs::path oldArchive = workDir.path / "old.psarc";
+  fs::path newArchive = workDir.path / "new.psarc";
+  fs::path output     = workDir.path / "diff.txt";
+
+  ASSERT_EQ(RunCommand(QuotePath(cli) + " pack " + QuotePath(oldDir) + " " + QuotePath(oldArchive)), 0);
+  ASSERT_EQ(RunCommand(QuotePath(cli) + " pack " + QuotePath(newDir) + " " + QuotePath(newArchive)), 0);
+
+  std::string diffCmd = QuotePath(cli) + " diff " + QuotePath(oldArchive) + " " + QuotePath(newArchive) + " > " + QuotePath(output);
+  ASSERT_EQ(RunCommand(diffCmd), 0) << "Diff command failed: " << diffCmd;
+
+  const std::string report = ReadFile(output);
+  EXPECT_NE(report.find("+ added.txt"), std::string::npos) << report;
+  EXPECT_NE(report.find("- removed.txt"), std::string::npos) << report;
+  EXPECT_NE(report.find("~ sub/changed.txt"), std::string::npos) << report;
+  EXPECT_EQ(report.find("same.txt"), std::string::npos) << report;
+  EXPECT_NE(report.find("1 added, 1 removed, 1 changed, 1 unchanged"), std::string::npos) << report;
+}
+
 // ---------------------------------------------------------------------------
 // Invalid argument handling
 // ---------------------------------------------------------------------------
@@ -1,10 +1,18 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <optional>
+#include <random>
+#include <set>
 #include <string>
 #include <vector>
 
 #include "memory_handles.hpp"
 #include "psarc_archive.hpp"
+#include "psarc_diff.hpp"
 #include "psarc_error.hpp"
 #include "psarc_impl.hpp"
 #include "psarc_types.hpp"
@@ -17,28 +25,66 @@ std::vector<byte> MakeBytes(std::string s) {
   return std::vector<byte>(s.begin(), s.end());
 }
 
-// Packs an archive to memory, then unpacks it and returns the reconstituted archive.
-// Settings are forwarded to Downsync so tests can vary compression type, block size, etc.
-Archive RoundTrip(Archive& source, PSArcSettings settings) {
-  // --- Downsync: archive → bytes ---
+// The files of an unpacked archive read their content lazily through the handle that parsed them.
+// Hence the serialized bytes and the reader handle have to outlive the archive returned by RoundTrip.
+struct RoundTripState {
   VectorOutputHandle output;
-  PSArcHandle writer;
-  writer.SetArchive(&source);
-  writer.SetSerializationEndpoint(&output);
-  PSArcStatus status = writer.Downsync(settings);
-  EXPECT_EQ(status, PSArcStatus::PSARC_STATUS_OK) << PSArcStatusToString(status);
-
-  // --- Upsync: bytes → archive ---
-  VectorInputHandle input(output.data);
-  Archive result;
+  std::optional<VectorInputHandle> input;
   PSArcHandle reader;
-  reader.SetParsingEndpoint(&input);
-  reader.SetArchive(&result);
-  status = reader.Upsync();
-  EXPECT_EQ(status, PSArcStatus::PSARC_STATUS_OK) << PSArcStatusToString(status);
+};
+
+// Every test owns its round trips and temporary directories, they are released when the test ends.
+class RoundTripTest : public ::testing::Test {
+protected:
+  std::list<RoundTripState> states;
+  std::vector<std::filesystem::path> temporaryDirectories;
+
+  void TearDown() override {
+    std::error_code error;
+    for (const std::filesystem::path& directory : temporaryDirectories)
+      std::filesystem::remove_all(directory, error);
+  }
 
-  return result;
-}
+  // Packs an archive to memory, then unpacks it and returns the reconstituted archive.
+  // Settings are forwarded to Downsync so tests can vary compression type, block size, etc.
+  Archive RoundTrip(Archive& source, PSArcSettings settings) {
+    RoundTripState& state = states.emplace_back();
+
+    // --- Downsync: archive → bytes ---
+    PSArcHandle writer;
+    writer.SetArchive(&source);
+    writer.SetSerializationEndpoint(&state.output);
+    PSArcStatus status = writer.Downsync(settings);
+    EXPECT_EQ(status, PSArcStatus::PSARC_STATUS_OK) << PSArcStatusToString(status);
+
+    // --- Upsync: bytes → archive ---
+    state.input.emplace(state.output.data);
+    Archive result;
+    state.reader.SetParsingEndpoint(&state.input.value());
+    state.reader.SetArchive(&result);
+    status = state.reader.Upsync();
+    EXPECT_EQ(status, PSArcStatus::PSARC_STATUS_OK) << PSArcStatusToString(status);
+
+    return result;
+  }
+
+  // The serialized bytes of the latest RoundTrip of this test.
+  const std::vector<byte>& LastOutput() const {
+    return states.back().output.data;
+  }
+
+  // Creates a directory below the system temp directory that no other test run uses.
+  std::filesystem::path MakeTemporaryDirectory(const std::string& name) {
+    std::random_device random;
+    std::filesystem::path directory;
+    do {
+      directory = std::filesystem::temp_directory_path() / (name + "_" + std::to_string(random()));
+    } while (!std::filesystem::create_directories(directory));
+
+    temporaryDirectories.push_back(directory);
+    return directory;
+  }
+};
 
 }  // anonymous namespace
 
@@ -46,7 +92,7 @@ Archive RoundTrip(Archive& source, PSArcSettings settings) {
 // Round-trip with LZMA compression (default)
 // ---------------------------------------------------------------------------
 
-TEST(RoundTrip, SingleFileLzma) {
+TEST_F(RoundTripTest, SingleFileLzma) {
   std::vector<byte> content = MakeBytes("Hello, PSArc round-trip test!");
 
   Archive source;
@@ -64,7 +110,7 @@ TEST(RoundTrip, SingleFileLzma) {
   EXPECT_EQ(*bytes, content);
 }
 
-TEST(RoundTrip, SingleFileZlib) {
+TEST_F(RoundTripTest, SingleFileZlib) {
   std::vector<byte> content = MakeBytes("Hello from ZLIB!");
 
   Archive source;
@@ -82,7 +128,7 @@ TEST(RoundTrip, SingleFileZlib) {
   EXPECT_EQ(*bytes, content);
 }
 
-TEST(RoundTrip, SingleFileNoCompression) {
+TEST_F(RoundTripTest, SingleFileNoCompression) {
   std::vector<byte> content = MakeBytes("Uncompressed data.");
 
   Archive source;
@@ -100,7 +146,7 @@ TEST(RoundTrip, SingleFileNoCompression) {
   EXPECT_EQ(*bytes, content);
 }
 
-TEST(RoundTrip, MultipleFiles) {
+TEST_F(RoundTripTest, MultipleFiles) {
   std::vector<byte> contentA = MakeBytes("File A contents");
   std::vector<byte> contentB = MakeBytes("File B contents");
   std::vector<byte> contentC = MakeBytes("File C contents");
@@ -134,7 +180,7 @@ TEST(RoundTrip, MultipleFiles) {
   }
 }
 
-TEST(RoundTrip, BinaryData) {
+TEST_F(RoundTripTest, BinaryData) {
   std::vector<byte> content(1024);
   for (size_t i = 0; i < content.size(); ++i)
     content[i] = static_cast<byte>(i & 0xFF);
@@ -154,7 +200,7 @@ TEST(RoundTrip, BinaryData) {
   EXPECT_EQ(*bytes, content);
 }
 
-TEST(RoundTrip, SmallBlockSize) {
+TEST_F(RoundTripTest, SmallBlockSize) {
   std::vector<byte> content(8192);
   for (size_t i = 0; i < content.size(); ++i)
     content[i] = static_cast<byte>(i % 64);
@@ -175,7 +221,7 @@ TEST(RoundTrip, SmallBlockSize) {
   EXPECT_EQ(*bytes, content);
 }
 
-TEST(RoundTrip, EmptyFilePreserved) {
+TEST_F(RoundTripTest, EmptyFilePreserved) {
   std::vector<byte> content;  // zero bytes
 
   Archive source;
@@ -193,7 +239,7 @@ TEST(RoundTrip, EmptyFilePreserved) {
   EXPECT_TRUE(bytes->empty());
 }
 
-TEST(RoundTrip, LargeFileZlib) {
+TEST_F(RoundTripTest, LargeFileZlib) {
   // 1 MiB of patterned data to stress multi-block paths.
   std::vector<byte> content(1024 * 1024);
   for (size_t i = 0; i < content.size(); ++i)
@@ -215,7 +261,7 @@ TEST(RoundTrip, LargeFileZlib) {
   EXPECT_EQ(*bytes, content);
 }
 
-TEST(RoundTrip, LargeFileLzma) {
+TEST_F(RoundTripTest, LargeFileLzma) {
   std::vector<byte> content(1024 * 1024);
   for (size_t i = 0; i < content.size(); ++i)
     content[i] = static_cast<byte>(i % 251);
@@ -236,7 +282,7 @@ TEST(RoundTrip, LargeFileLzma) {
   EXPECT_EQ(*bytes, content);
 }
 
-TEST(RoundTrip, FileCountPreservedAcrossRoundTrip) {
+TEST_F(RoundTripTest, FileCountPreservedAcrossRoundTrip) {
   Archive source;
   for (int i = 0; i < 20; ++i)
     source.AddFile(File("file_" + std::to_string(i) + ".txt", MakeBytes("content " + std::to_string(i))));
@@ -248,7 +294,7 @@ TEST(RoundTrip, FileCountPreservedAcrossRoundTrip) {
   EXPECT_EQ(result.GetFileCount(), 20u);
 }
 
-TEST(RoundTrip, FilesWithSubdirectoryPaths) {
+TEST_F(RoundTripTest, FilesWithSubdirectoryPaths) {
   std::vector<byte> contentA = MakeBytes("deep file A");
   std::vector<byte> contentB = MakeBytes("deep file B");
 
@@ -269,7 +315,7 @@ TEST(RoundTrip, FilesWithSubdirectoryPaths) {
   EXPECT_EQ(*fb->GetUncompressedBytes(), contentB);
 }
 
-TEST(RoundTrip, AllZeroBytesFile) {
+TEST_F(RoundTripTest, AllZeroBytesFile) {
   std::vector<byte> content(4096, static_cast<byte>(0x00));
 
   Archive source;
@@ -287,7 +333,7 @@ TEST(RoundTrip, AllZeroBytesFile) {
   EXPECT_EQ(*bytes, content);
 }
 
-TEST(RoundTrip, MixedCompressionTypes) {
+TEST_F(RoundTripTest, MixedCompressionTypes) {
   // Pack with LZMA; read back and verify every file regardless of codec.
   Archive source;
   source.AddFile(File("alpha.txt", MakeBytes("alpha content")));
@@ -302,7 +348,7 @@ TEST(RoundTrip, MixedCompressionTypes) {
   EXPECT_EQ(*result.FindFile("beta.txt")->GetUncompressedBytes(), MakeBytes("beta content"));
 }
 
-TEST(RoundTrip, SmallBlockSizeLzma) {
+TEST_F(RoundTripTest, SmallBlockSizeLzma) {
   std::vector<byte> content(8192);
   for (size_t i = 0; i < content.size(); ++i)
     content[i] = static_cast<byte>(i % 64);
@@ -323,7 +369,91 @@ TEST(RoundTrip, SmallBlockSizeLzma) {
   EXPECT_EQ(*bytes, content);
 }
 
-TEST(RoundTrip, FileNamesArePreserved) {
+TEST_F(RoundTripTest, IncompressibleBlocksLzma) {
+  // Full and partial blocks that do not compress are stored as is and must be classified as such.
+  std::vector<byte> content(2 * 1024 + 100);
+  uint32_t state = 0x9E3779B9u;
+  for (size_t i = 0; i < content.size(); ++i) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    content[i] = static_cast<byte>(state & 0xFF);
+  }
+
+  Archive source;
+  source.AddFile(File("stored.bin", content));
+
+  PSArcSettings settings;
+  settings.compressionType = CompressionType::PSARC_COMPRESSION_TYPE_LZMA;
+  settings.blockSize       = 1024;
+
+  Archive result = RoundTrip(source, settings);
+
+  File* f = result.FindFile("stored.bin");
+  ASSERT_NE(f, nullptr);
+  EXPECT_EQ(*f->GetUncompressedBytes(), content);
+}
+
+TEST_F(RoundTripTest, DecompressIntoFromArchive) {
+  std::vector<byte> content(10 * 1024 + 17);
+  for (size_t i = 0; i < content.size(); ++i)
+    content[i] = static_cast<byte>(i % 61);
+
+  Archive source;
+  source.AddFile(File("into.bin", content));
+
+  PSArcSettings settings;
+  settings.compressionType = CompressionType::PSARC_COMPRESSION_TYPE_ZLIB;
+  settings.blockSize       = 1024;
+
+  Archive result = RoundTrip(source, settings);
+
+  File* f = result.FindFile("into.bin");
+  ASSERT_NE(f, nullptr);
+
+  std::vector<byte> whole(f->GetUncompressedSize());
+  ASSERT_TRUE(f->DecompressInto(whole));
+  EXPECT_EQ(whole, content);
+
+  // The last two blocks, the final one being partial.
+  std::vector<byte> tail(1024 + 17);
+  ASSERT_TRUE(f->DecompressInto(tail, 9, 2));
+  EXPECT_TRUE(std::equal(tail.begin(), tail.end(), content.begin() + 9 * 1024));
+}
+
+TEST_F(RoundTripTest, LooseFileSources) {
+  const std::filesystem::path dir = MakeTemporaryDirectory("psarc_test_loose_sources");
+
+  std::vector<byte> content(5 * 1024 + 3);
+  for (size_t i = 0; i < content.size(); ++i)
+    content[i] = static_cast<byte>(i % 29);
+
+  std::ofstream(dir / "loose.bin", std::ios::binary).write(reinterpret_cast<const char*>(content.data()), content.size());
+
+  std::shared_ptr<LooseFileSource> fileSource = std::make_shared<LooseFileSource>(dir / "loose.bin");
+  ASSERT_TRUE(fileSource->IsValid());
+  EXPECT_EQ(fileSource->GetUncompressedSize(), content.size());
+  EXPECT_FALSE(LooseFileSource(dir / "missing.bin").IsValid());
+
+  Archive source;
+  source.AddFile(File("loose.bin", fileSource));
+
+  PSArcSettings settings;
+  settings.blockSize = 1024;
+
+  Archive result = RoundTrip(source, settings);
+
+  // Nothing is kept in memory once the file was written.
+  File* written = source.FindFile("loose.bin");
+  ASSERT_NE(written, nullptr);
+  EXPECT_FALSE(written->IsCompressedSizeAvailable());
+
+  File* f = result.FindFile("loose.bin");
+  ASSERT_NE(f, nullptr);
+  EXPECT_EQ(*f->GetUncompressedBytes(), content);
+}
+
+TEST_F(RoundTripTest, FileNamesArePreserved) {
   // Verify that the exact file name (including extension) survives a round-trip.
   const char* name          = "unusual.name.with.dots.bin";
   std::vector<byte> content = MakeBytes("content");
@@ -338,7 +468,7 @@ TEST(RoundTrip, FileNamesArePreserved) {
   EXPECT_NE(result.FindFile(name), nullptr);
 }
 
-TEST(RoundTrip, IdenticalContentsInDifferentFiles) {
+TEST_F(RoundTripTest, IdenticalContentsInDifferentFiles) {
   // Two files with identical content should both round-trip independently.
   std::vector<byte> content = MakeBytes("same content");
 
@@ -359,7 +489,219 @@ TEST(RoundTrip, IdenticalContentsInDifferentFiles) {
   EXPECT_EQ(*f2->GetUncompressedBytes(), content);
 }
 
-TEST(RoundTrip, BinaryDataNoCompression) {
+TEST_F(RoundTripTest, DuplicateFilesShareData) {
+  std::vector<byte> content(8 * 1024);
+  std::vector<byte> sameSize(8 * 1024);
+  uint32_t state = 0x1234ABCDu;
+  for (size_t i = 0; i < content.size(); ++i) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    content[i]  = static_cast<byte>(state);
+    sameSize[i] = static_cast<byte>(state >> 8);
+  }
+
+  auto pack = [&](bool deduplicateFiles) {
+    Archive source;
+    source.AddFile(File("a.bin", content));
+    source.AddFile(File("b.bin", sameSize));
+    source.AddFile(File("c.bin", content));
+
+    PSArcSettings settings;
+    settings.compressionType  = CompressionType::PSARC_COMPRESSION_TYPE_ZLIB;
+    settings.blockSize        = 1024;
+    settings.endianness       = std::endian::native;
+    settings.deduplicateFiles = deduplicateFiles;
+
+    VectorOutputHandle output;
+    PSArcHandle writer;
+    writer.SetArchive(&source);
+    writer.SetSerializationEndpoint(&output);
+    EXPECT_EQ(writer.Downsync(settings), PSArcStatus::PSARC_STATUS_OK);
+    return output.data;
+  };
+
+  const std::vector<byte> deduplicated = pack(true);
+  const std::vector<byte> plain        = pack(false);
+  EXPECT_LE(deduplicated.size() + content.size(), plain.size());
+
+  // TOC entries: manifest, a.bin, b.bin, c.bin.
+  std::vector<byte> raw = deduplicated;
+  TocEntry a(raw.data(), 0x20 + 30 * 1);
+  TocEntry b(raw.data(), 0x20 + 30 * 2);
+  TocEntry c(raw.data(), 0x20 + 30 * 3);
+  EXPECT_EQ(a.fileOffset, c.fileOffset);
+  EXPECT_EQ(a.blockOffset, c.blockOffset);
+  EXPECT_NE(a.fileOffset, b.fileOffset);
+  EXPECT_NE(std::memcmp(a.md5Hash, c.md5Hash, 16), 0);
+
+  VectorInputHandle input(deduplicated);
+  Archive result;
+  PSArcHandle reader;
+  reader.SetParsingEndpoint(&input);
+  reader.SetArchive(&result);
+  ASSERT_EQ(reader.Upsync(), PSArcStatus::PSARC_STATUS_OK);
+
+  ASSERT_NE(result.FindFile("a.bin"), nullptr);
+  ASSERT_NE(result.FindFile("b.bin"), nullptr);
+  ASSERT_NE(result.FindFile("c.bin"), nullptr);
+  EXPECT_EQ(*result.FindFile("a.bin")->GetUncompressedBytes(), content);
+  EXPECT_EQ(*result.FindFile("b.bin")->GetUncompressedBytes(), sameSize);
+  EXPECT_EQ(*result.FindFile("c.bin")->GetUncompressedBytes(), content);
+}
+
+TEST_F(RoundTripTest, RepackDeduplicatesParsedFiles) {
+  // The files of a parsed archive all read from one endpoint, hashing them from several threads must not mix up their content.
+  Archive source;
+  std::vector<std::vector<byte>> contents;
+  for (size_t i = 0; i < 12; i++) {
+    std::vector<byte> content(3000);
+    for (size_t j = 0; j < content.size(); j++)
+      content[j] = static_cast<byte>((j * (i % 4 + 1) + i % 4) % 251);
+
+    contents.push_back(content);
+    source.AddFile(File("file" + std::to_string(i) + ".bin", content));
+  }
+
+  PSArcSettings settings;
+  settings.compressionType = CompressionType::PSARC_COMPRESSION_TYPE_ZLIB;
+  settings.blockSize       = 1024;
+
+  Archive parsed = RoundTrip(source, settings);
+
+  settings.deduplicateFiles = true;
+  Archive result            = RoundTrip(parsed, settings);
+
+  // Files with the same i % 4 are identical, only four of them are stored.
+  std::set<uint64_t> fileOffsets;
+  const std::vector<byte>& raw = LastOutput();
+  for (size_t i = 1; i <= contents.size(); i++)
+    fileOffsets.insert(TocEntry(const_cast<byte*>(raw.data()), 0x20 + 30 * i).fileOffset);
+  EXPECT_EQ(fileOffsets.size(), 4u);
+
+  for (size_t i = 0; i < contents.size(); i++) {
+    File* file = result.FindFile("file" + std::to_string(i) + ".bin");
+    ASSERT_NE(file, nullptr);
+    EXPECT_EQ(*file->GetUncompressedBytes(), contents[i]);
+  }
+}
+
+TEST_F(RoundTripTest, RepackUncompressedArchive) {
+  // The files of an uncompressed archive are streamed block by block from its endpoint by the compression workers, the large file
+  // is also split into ranges.
+  Archive source;
+  std::vector<std::vector<byte>> contents;
+  for (size_t i = 0; i < 8; i++) {
+    std::vector<byte> content((i == 0) ? 40 * 1024 + 7 : 2000 + i * 300);
+    for (size_t j = 0; j < content.size(); j++)
+      content[j] = static_cast<byte>((j * (i + 1) + j / 500) % 251);
+
+    contents.push_back(content);
+    source.AddFile(File("file" + std::to_string(i) + ".bin", content));
+  }
+
+  PSArcSettings settings;
+  settings.compressionType = CompressionType::PSARC_COMPRESSION_TYPE_NONE;
+  settings.blockSize       = 1024;
+
+  // Every block is stored as is, an unknown compression type in the header makes the parser treat the archive as uncompressed.
+  VectorOutputHandle output;
+  PSArcHandle writer;
+  writer.SetArchive(&source);
+  writer.SetSerializationEndpoint(&output);
+  ASSERT_EQ(writer.Downsync(settings), PSArcStatus::PSARC_STATUS_OK);
+  std::memcpy(output.data.data() + 0x08, "none", 4);
+
+  VectorInputHandle input(output.data);
+  Archive parsed;
+  PSArcHandle reader;
+  reader.SetParsingEndpoint(&input);
+  reader.SetArchive(&parsed);
+  ASSERT_EQ(reader.Upsync(), PSArcStatus::PSARC_STATUS_OK);
+  ASSERT_EQ(reader.compressionType, CompressionType::PSARC_COMPRESSION_TYPE_NONE);
+
+  settings.compressionType     = CompressionType::PSARC_COMPRESSION_TYPE_ZLIB;
+  settings.compressionTaskSize = 8 * 1024;
+  Archive result               = RoundTrip(parsed, settings);
+
+  for (size_t i = 0; i < contents.size(); i++) {
+    File* file = result.FindFile("file" + std::to_string(i) + ".bin");
+    ASSERT_NE(file, nullptr);
+    EXPECT_EQ(*file->GetUncompressedBytes(), contents[i]);
+  }
+}
+
+TEST_F(RoundTripTest, DuplicateBlocksAcrossFiles) {
+  const size_t blockSize = 1024;
+  std::vector<byte> header(blockSize);
+  for (size_t i = 0; i < header.size(); ++i)
+    header[i] = static_cast<byte>((i * 7) % 251);
+
+  // Both files start with the same block and differ afterwards.
+  std::vector<byte> first = header, second = header;
+  first.insert(first.end(), 300, 1);
+  second.insert(second.end(), 500, 2);
+
+  Archive source;
+  source.AddFile(File("first.bin", first));
+  source.AddFile(File("second.bin", second));
+
+  PSArcSettings settings;
+  settings.compressionType   = CompressionType::PSARC_COMPRESSION_TYPE_LZMA;
+  settings.blockSize         = blockSize;
+  settings.deduplicateBlocks = true;
+
+  PSArcHandle analyzer;
+  analyzer.SetArchive(&source);
+  BlockDuplicateReport report;
+  ASSERT_EQ(analyzer.AnalyzeBlockDuplicates(settings, report), PSArcStatus::PSARC_STATUS_OK);
+  EXPECT_EQ(report.totalBlocks, 4u);
+  EXPECT_EQ(report.duplicateBlocks, 1u);
+  EXPECT_EQ(report.duplicateBytes, blockSize);
+
+  Archive result = RoundTrip(source, settings);
+
+  ASSERT_NE(result.FindFile("first.bin"), nullptr);
+  ASSERT_NE(result.FindFile("second.bin"), nullptr);
+  EXPECT_EQ(*result.FindFile("first.bin")->GetUncompressedBytes(), first);
+  EXPECT_EQ(*result.FindFile("second.bin")->GetUncompressedBytes(), second);
+
+  // The files of the parsed archive share its endpoint, the analysis must come to the same result.
+  PSArcHandle parsedAnalyzer;
+  parsedAnalyzer.SetArchive(&result);
+  BlockDuplicateReport parsedReport;
+  ASSERT_EQ(parsedAnalyzer.AnalyzeBlockDuplicates(settings, parsedReport), PSArcStatus::PSARC_STATUS_OK);
+  EXPECT_EQ(parsedReport.totalBlocks, report.totalBlocks);
+  EXPECT_EQ(parsedReport.duplicateBlocks, report.duplicateBlocks);
+  EXPECT_EQ(parsedReport.duplicateBytes, report.duplicateBytes);
+}
+
+TEST_F(RoundTripTest, RepackPassesBlocksThrough) {
+  std::vector<byte> content(6 * 1024 + 5);
+  for (size_t i = 0; i < content.size(); ++i)
+    content[i] = static_cast<byte>((i * 13) % 41);
+
+  Archive source;
+  source.AddFile(File("pass.bin", content));
+
+  PSArcSettings settings;
+  settings.compressionType = CompressionType::PSARC_COMPRESSION_TYPE_ZLIB;
+  settings.blockSize       = 1024;
+
+  Archive unpacked = RoundTrip(source, settings);
+  Archive repacked = RoundTrip(unpacked, settings);
+
+  File* original = unpacked.FindFile("pass.bin");
+  ASSERT_NE(original, nullptr);
+  EXPECT_FALSE(original->IsCompressedSizeAvailable());
+
+  File* f = repacked.FindFile("pass.bin");
+  ASSERT_NE(f, nullptr);
+  EXPECT_EQ(f->GetBlockCount(), 7u);
+  EXPECT_EQ(*f->GetUncompressedBytes(), content);
+}
+
+TEST_F(RoundTripTest, BinaryDataNoCompression) {
   // Random-like binary data stored without compression should survive unchanged.
   std::vector<byte> content(512);
   uint32_t state = 0xABCD1234u;
@@ -383,6 +725,104 @@ TEST(RoundTrip, BinaryDataNoCompression) {
   EXPECT_EQ(*f->GetUncompressedBytes(), content);
 }
 
+TEST_F(RoundTripTest, ManifestOrderIsPreserved) {
+  Archive source;
+  source.AddFile(File("PSArcManifest.bin", MakeBytes("/dir/c.bin\n/b.bin\n/missing.bin\na.bin\n/dir/c.bin")));
+  source.AddFile(File("a.bin", MakeBytes("a")));
+  source.AddFile(File("b.bin", MakeBytes("b")));
+  source.AddFile(File("d.bin", MakeBytes("d")));
+  source.AddFile(File("dir/c.bin", MakeBytes("c")));
+
+  PSArcSettings settings;
+  Archive result = RoundTrip(source, settings);
+
+  // Listed files come first in the order of the original manifest, files it does not list follow.
+  File* manifest = result.FindFile("PSArcManifest.bin");
+  ASSERT_NE(manifest, nullptr);
+  EXPECT_EQ(*manifest->GetUncompressedBytes(), MakeBytes("/dir/c.bin\n/b.bin\n/a.bin\n/d.bin"));
+  EXPECT_EQ(*result.FindFile("dir/c.bin")->GetUncompressedBytes(), MakeBytes("c"));
+  EXPECT_EQ(*result.FindFile("d.bin")->GetUncompressedBytes(), MakeBytes("d"));
+}
+
+TEST_F(RoundTripTest, SmallWriteWindow) {
+  // With a window of one file the workers can only compress the file that is written next, the order in the archive must not change.
+  Archive source;
+  std::vector<std::vector<byte>> contents;
+  for (size_t i = 0; i < 40; i++) {
+    std::vector<byte> content(1000 + i * 997);
+    for (size_t j = 0; j < content.size(); j++)
+      content[j] = byte((i * 31 + j * (i + 3)) % 251);
+
+    contents.push_back(content);
+    source.AddFile(File("dir" + std::to_string(i % 4) + "/file" + std::to_string(i) + ".bin", content));
+  }
+
+  for (size_t window : {size_t(1), size_t(3)}) {
+    PSArcSettings settings;
+    settings.compressionType = CompressionType::PSARC_COMPRESSION_TYPE_ZLIB;
+    settings.blockSize       = 4096;
+    settings.writeWindow     = window;
+
+    Archive result = RoundTrip(source, settings);
+    ASSERT_EQ(result.GetFileCount(), contents.size());
+
+    for (size_t i = 0; i < contents.size(); i++) {
+      File* file = result.FindFile("dir" + std::to_string(i % 4) + "/file" + std::to_string(i) + ".bin");
+      ASSERT_NE(file, nullptr);
+      EXPECT_EQ(*file->GetUncompressedBytes(), contents[i]);
+
+      // Files held in memory only keep their uncompressed bytes once they were written.
+      File* written = source.FindFile("dir" + std::to_string(i % 4) + "/file" + std::to_string(i) + ".bin");
+      ASSERT_NE(written, nullptr);
+      EXPECT_FALSE(written->IsCompressedSizeAvailable());
+      EXPECT_EQ(*written->GetUncompressedBytes(), contents[i]);
+    }
+  }
+}
+
+TEST_F(RoundTripTest, LargeFilesAreCompressedInRanges) {
+  // Both files span several compression tasks, the loose file also has a different block size than the archive. Splitting them must
+  // not change a single byte of the archive.
+  const std::filesystem::path dir = MakeTemporaryDirectory("psarc_test_block_ranges");
+
+  std::vector<byte> memoryContent(37 * 1024 + 11);
+  for (size_t i = 0; i < memoryContent.size(); ++i)
+    memoryContent[i] = static_cast<byte>((i * 7 + i / 300) % 251);
+
+  std::vector<byte> looseContent(150 * 1024 + 5);
+  for (size_t i = 0; i < looseContent.size(); ++i)
+    looseContent[i] = static_cast<byte>((i / 3) % 89);
+
+  std::ofstream(dir / "loose.bin", std::ios::binary).write(reinterpret_cast<const char*>(looseContent.data()), looseContent.size());
+
+  std::vector<std::vector<byte>> outputs;
+
+  for (size_t taskSize : {size_t(0), size_t(4096), size_t(1)}) {
+    Archive source;
+    source.AddFile(File("memory.bin", memoryContent));
+    source.AddFile(File("loose.bin", std::make_shared<LooseFileSource>(dir / "loose.bin")));
+    source.AddFile(File("small.txt", MakeBytes("small")));
+
+    PSArcSettings settings;
+    settings.compressionType     = CompressionType::PSARC_COMPRESSION_TYPE_ZLIB;
+    settings.blockSize           = 1024;
+    settings.compressionTaskSize = taskSize;
+
+    Archive result = RoundTrip(source, settings);
+    outputs.push_back(LastOutput());
+
+    File* memoryFile = result.FindFile("memory.bin");
+    File* looseFile  = result.FindFile("loose.bin");
+    ASSERT_NE(memoryFile, nullptr);
+    ASSERT_NE(looseFile, nullptr);
+    EXPECT_EQ(*memoryFile->GetUncompressedBytes(), memoryContent);
+    EXPECT_EQ(*looseFile->GetUncompressedBytes(), looseContent);
+  }
+
+  EXPECT_EQ(outputs[1], outputs[0]);
+  EXPECT_EQ(outputs[2], outputs[0]);
+}
+
 // ---------------------------------------------------------------------------
 // Regression: TOC header fields must include the manifest entry
 //
@@ -392,7 +832,7 @@ TEST(RoundTrip, BinaryDataNoCompression) {
 // they account for all files including the manifest.
 // ---------------------------------------------------------------------------
 
-TEST(RoundTrip, TocHeaderIncludesManifestEntry) {
+TEST_F(RoundTripTest, TocHeaderIncludesManifestEntry) {
   const size_t kNumFiles = 3;
 
   Archive source;
@@ -446,3 +886,66 @@ TEST(RoundTrip, TocHeaderIncludesManifestEntry) {
   ASSERT_EQ(reader.Upsync(), PSArcStatus::PSARC_STATUS_OK);
   EXPECT_EQ(result.GetFileCount(), kNumFiles);
 }
+
+// ---------------------------------------------------------------------------
+// Diff of two packed archives
+// ---------------------------------------------------------------------------
+
+TEST_F(RoundTripTest, DiffPackedArchives) {
+  std::vector<byte> large(200 * 1024);
+  for (size_t i = 0; i < large.size(); ++i)
+    large[i] = byte((i * 7) % 13);
+
+  std::vector<byte> largeEdited = large;
+  largeEdited[100 * 1024]       = byte(0xFF);
+
+  Archive oldSource;
+  oldSource.AddFile(File("same/large.bin", large));
+  oldSource.AddFile(File("same/small.txt", MakeBytes("unchanged")));
+  oldSource.AddFile(File("edited/large.bin", large));
+  oldSource.AddFile(File("removed.txt", MakeBytes("removed")));
+
+  Archive newSource;
+  newSource.AddFile(File("same/large.bin", large));
+  newSource.AddFile(File("same/small.txt", MakeBytes("unchanged")));
+  newSource.AddFile(File("edited/large.bin", largeEdited));
+  newSource.AddFile(File("added.txt", MakeBytes("added")));
+
+  PSArcSettings settings;
+  Archive oldArchive = RoundTrip(oldSource, settings);
+  Archive newArchive = RoundTrip(newSource, settings);
+
+  ArchiveDiff diff;
+  ASSERT_EQ(DiffArchives(oldArchive, newArchive, diff), PSArcStatus::PSARC_STATUS_OK);
+
+  ASSERT_EQ(diff.files.size(), 5u);
+  EXPECT_EQ(diff.files[0].path, "added.txt");
+  EXPECT_EQ(diff.files[0].status, PSARC_FILE_DIFF_STATUS_ADDED);
+  EXPECT_EQ(diff.files[1].path, "edited/large.bin");
+  EXPECT_EQ(diff.files[1].status, PSARC_FILE_DIFF_STATUS_CHANGED);
+  EXPECT_EQ(diff.files[2].path, "removed.txt");
+  EXPECT_EQ(diff.files[2].status, PSARC_FILE_DIFF_STATUS_REMOVED);
+  EXPECT_EQ(diff.files[3].status, PSARC_FILE_DIFF_STATUS_UNCHANGED);
+  EXPECT_EQ(diff.files[4].status, PSARC_FILE_DIFF_STATUS_UNCHANGED);
+}
+
+TEST_F(RoundTripTest, DiffUncompressedArchives) {
+  Archive oldSource;
+  oldSource.AddFile(File("a.txt", MakeBytes("content a")));
+  oldSource.AddFile(File("b.txt", MakeBytes("content b")));
+
+  Archive newSource;
+  newSource.AddFile(File("a.txt", MakeBytes("content a")));
+  newSource.AddFile(File("b.txt", MakeBytes("content B")));
+
+  PSArcSettings settings;
+  settings.compressionType = CompressionType::PSARC_COMPRESSION_TYPE_NONE;
+  Archive oldArchive       = RoundTrip(oldSource, settings);
+  Archive newArchive       = RoundTrip(newSource, settings);
+
+  ArchiveDiff diff;
+  ASSERT_EQ(DiffArchives(oldArchive, newArchive, diff), PSArcStatus::PSARC_STATUS_OK);
+  EXPECT_EQ(diff.unchangedCount, 1u);
+  EXPECT_EQ(diff.changedCount, 1u);
+  EXPECT_EQ(diff.addedCount + diff.removedCount, 0u);
+}
@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 #include "psarc_archive.hpp"
@@ -15,6 +18,72 @@ std::vector<byte> MakeBytes(std::string s) {
   return std::vector<byte>(s.begin(), s.end());
 }
 
+// Uncompressed in-memory source that counts how often it was read.
+class CountingSource : public FileSourceProvider {
+public:
+  CountingSource(std::vector<byte> _bytes) : bytes(std::move(_bytes)) {};
+  FileData GetData() override {
+    this->reads++;
+    FileData data;
+    data.bytes                    = this->bytes;
+    data.uncompressedMaxBlockSize = 65536;
+    data.uncompressedTotalSize    = this->bytes.size();
+    data.compressedMaxBlockSize   = 65536;
+    return data;
+  }
+  CompressionType GetCompressionType() override {
+    return CompressionType::PSARC_COMPRESSION_TYPE_NONE;
+  }
+  bool HasUncompressedSize() override {
+    return true;
+  }
+  size_t GetUncompressedSize() override {
+    return this->bytes.size();
+  }
+
+  std::vector<byte> bytes;
+  size_t reads = 0;
+};
+
+// Uncompressed source that only supports block reads, GetData must never be needed.
+class BlockOnlySource : public FileSourceProvider {
+public:
+  BlockOnlySource(std::vector<byte> _bytes, size_t _blockSize) : bytes(std::move(_bytes)), blockSize(_blockSize) {};
+  FileData GetData() override {
+    this->dataReads++;
+    return FileData();
+  }
+  CompressionType GetCompressionType() override {
+    return CompressionType::PSARC_COMPRESSION_TYPE_NONE;
+  }
+  bool HasUncompressedSize() override {
+    return true;
+  }
+  size_t GetUncompressedSize() override {
+    return this->bytes.size();
+  }
+  size_t GetBlockCount() override {
+    return (this->bytes.size() + this->blockSize - 1) / this->blockSize;
+  }
+  size_t GetMaxBlockSize() override {
+    return this->blockSize;
+  }
+  BlockDescriptor GetBlockDescriptor(size_t index) override {
+    return BlockDescriptor {uint32_t(std::min(this->blockSize, this->bytes.size() - index * this->blockSize)), false};
+  }
+  bool ReadBlock(size_t index, std::span<byte> dst) override {
+    std::copy_n(this->bytes.begin() + index * this->blockSize, dst.size(), dst.begin());
+    return true;
+  }
+  bool SupportsBlockAccess() override {
+    return true;
+  }
+
+  std::vector<byte> bytes;
+  size_t blockSize;
+  size_t dataReads = 0;
+};
+
 }  // anonymous namespace
 
 // ---------------------------------------------------------------------------
@@ -76,6 +145,39 @@ TEST(Archive, IteratorEmptyArchive) {
   EXPECT_EQ(*it, nullptr);
 }
 
+TEST(Archive, IterationOrders) {
+  Archive archive;
+  archive.AddFile(File("a/x/1.txt", MakeBytes("1")));
+  archive.AddFile(File("b/2.txt", MakeBytes("2")));
+  archive.AddFile(File("a/3.txt", MakeBytes("3")));
+  archive.AddFile(File("4.txt", MakeBytes("4")));
+  archive.AddFile(File("PSArcManifest.bin", MakeBytes("")));
+
+  std::vector<std::string> breadthFirst;
+  for (File* file : archive)
+    breadthFirst.push_back(file->GetPathString());
+
+  std::vector<std::string> depthFirst;
+  for (File* file : archive.GetFiles(Archive::PSARC_ITERATION_ORDER_DEPTH_FIRST))
+    depthFirst.push_back(file->GetPathString());
+
+  EXPECT_EQ(breadthFirst, (std::vector<std::string> {"PSArcManifest.bin", "4.txt", "a/3.txt", "b/2.txt", "a/x/1.txt"}));
+  EXPECT_EQ(depthFirst, (std::vector<std::string> {"PSArcManifest.bin", "4.txt", "a/3.txt", "a/x/1.txt", "b/2.txt"}));
+}
+
+TEST(Archive, IteratorIsTriviallyCopyable) {
+  static_assert(std::is_trivially_copyable_v<Archive::Iterator>);
+
+  Archive archive;
+  archive.AddFile(File("a.txt", MakeBytes("a")));
+
+  Archive::Iterator it   = archive.begin();
+  Archive::Iterator copy = it++;
+  EXPECT_NE(*copy, nullptr);
+  EXPECT_EQ(it, archive.end());
+  EXPECT_EQ(*it, nullptr);
+}
+
 // ---------------------------------------------------------------------------
 // File — content and state
 // ---------------------------------------------------------------------------
@@ -118,6 +220,36 @@ TEST(File, CompressAndDecompressLzma) {
   EXPECT_EQ(*decompressed, data);
 }
 
+TEST(File, CompressBlockRangesMatchesCompress) {
+  std::vector<byte> data(10 * 1024 + 100);
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<byte>((i * 13 + i / 700) % 64);
+
+  File whole("whole.bin", data);
+  whole.Compress(CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 1024);
+
+  File split("split.bin", data);
+  ASSERT_TRUE(split.CanCompressBlockRanges());
+
+  // Ranges of 4, 4 and 3 blocks, compressed out of order.
+  std::vector<FileData> ranges(3);
+  EXPECT_TRUE(split.CompressBlockRange(CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 1024, 8, 4, ranges[2], nullptr));
+  EXPECT_TRUE(split.CompressBlockRange(CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 1024, 0, 4, ranges[0], nullptr));
+  EXPECT_TRUE(split.CompressBlockRange(CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 1024, 4, 4, ranges[1], nullptr));
+
+  FileData outOfRange;
+  EXPECT_FALSE(split.CompressBlockRange(CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 1024, 11, 1, outOfRange, nullptr));
+  EXPECT_FALSE(split.IsCompressedSizeAvailable());
+
+  split.SetCompressedBlockRanges(ranges, CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 1024);
+  EXPECT_EQ(*split.GetCompressedBytes(), *whole.GetCompressedBytes());
+  EXPECT_EQ(split.GetCompressedBlocks().size(), whole.GetCompressedBlocks().size());
+
+  split.ClearUncompressedBytes();
+  split.Decompress();
+  EXPECT_EQ(*split.GetUncompressedBytes(), data);
+}
+
 TEST(File, IsManifestDetectedByName) {
   // The manifest is identified by a known name. Verify a regular file is not a manifest.
   File f("regular.txt", MakeBytes("data"));
@@ -129,6 +261,30 @@ TEST(File, PathStringRelative) {
   EXPECT_FALSE(f.GetPathString(PathType::PSARC_PATH_TYPE_RELATIVE).empty());
 }
 
+TEST(File, DecompressIntoCallerBuffer) {
+  std::vector<byte> data(4096);
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<byte>(i % 64);
+
+  File f("into.bin", data);
+  f.Compress(CompressionType::PSARC_COMPRESSION_TYPE_LZMA, 1024);
+  f.ClearUncompressedBytes();
+
+  std::vector<byte> whole(data.size());
+  ASSERT_TRUE(f.DecompressInto(whole));
+  EXPECT_EQ(whole, data);
+
+  // Blocks 1 and 2 of 1 KiB each.
+  std::vector<byte> range(2 * 1024);
+  ASSERT_TRUE(f.DecompressInto(range, 1, 2));
+  EXPECT_TRUE(std::equal(range.begin(), range.end(), data.begin() + 1024));
+
+  // The destination has to match the size of the requested blocks exactly.
+  std::vector<byte> tooSmall(1024);
+  EXPECT_FALSE(f.DecompressInto(tooSmall, 1, 2));
+  EXPECT_FALSE(f.DecompressInto(range, 3, 2));
+}
+
 // ---------------------------------------------------------------------------
 // PSArcStatus string conversion
 // ---------------------------------------------------------------------------
@@ -214,6 +370,19 @@ TEST(File, ClearCompressedBytesDoesNotAffectUncompressed) {
   EXPECT_EQ(*bytes, data);
 }
 
+TEST(File, GettersShareCachedBytes) {
+  std::vector<byte> data = MakeBytes("shared content");
+  File f("shared.txt", data);
+
+  auto first  = f.GetUncompressedBytes();
+  auto second = f.GetUncompressedBytes();
+  EXPECT_EQ(first.get(), second.get());  // no copy per call
+
+  // Callers keep their bytes alive even after the cache is cleared.
+  f.ClearUncompressedBytes();
+  EXPECT_EQ(*first, data);
+}
+
 // ---------------------------------------------------------------------------
 // Archive — large number of files
 // ---------------------------------------------------------------------------
@@ -299,7 +468,7 @@ TEST(File, ClearUncompressedBytesCompressedStillAvailable) {
 }
 
 // ---------------------------------------------------------------------------
-// File — GetCompressedBlockSizes
+// File — GetCompressedBlocks
 // ---------------------------------------------------------------------------
 
 TEST(File, BlockSizesNonEmptyAfterCompress) {
@@ -309,7 +478,7 @@ TEST(File, BlockSizesNonEmptyAfterCompress) {
 
   File f("blocks.bin", data);
   f.Compress(CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 1024);
-  EXPECT_FALSE(f.GetCompressedBlockSizes().empty());
+  EXPECT_FALSE(f.GetCompressedBlocks().empty());
 }
 
 TEST(File, BlockCountMatchesExpectedBlocks) {
@@ -320,7 +489,313 @@ TEST(File, BlockCountMatchesExpectedBlocks) {
 
   File f("block_count.bin", data);
   f.Compress(CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 1024);
-  EXPECT_EQ(f.GetCompressedBlockSizes().size(), 4u);
+  EXPECT_EQ(f.GetCompressedBlocks().size(), 4u);
+}
+
+TEST(File, PathViewsMatchPathStrings) {
+  File withSlash("/dir/a.txt", MakeBytes("a"));
+  File withoutSlash("dir/b.txt", MakeBytes("b"));
+
+  EXPECT_EQ(withSlash.GetPathView(PathType::PSARC_PATH_TYPE_RELATIVE), "dir/a.txt");
+  EXPECT_EQ(withSlash.GetPathView(PathType::PSARC_PATH_TYPE_ABSOLUTE), "/dir/a.txt");
+  EXPECT_EQ(withSlash.GetPathView(PathType::PSARC_PATH_TYPE_IGNORECASE), "/dir/a.txt");
+  EXPECT_EQ(withoutSlash.GetPathView(PathType::PSARC_PATH_TYPE_IGNORECASE), "dir/b.txt");
+
+  for (PathType type : {PSARC_PATH_TYPE_RELATIVE, PSARC_PATH_TYPE_IGNORECASE, PSARC_PATH_TYPE_ABSOLUTE}) {
+    EXPECT_EQ(withSlash.GetPathString(type), withSlash.GetPathView(type));
+    EXPECT_EQ(withoutSlash.GetPathString(type), withoutSlash.GetPathView(type));
+  }
+
+  // The views point into the file and survive moving it into an archive.
+  Archive archive;
+  archive.AddFile(std::move(withSlash));
+  EXPECT_EQ(archive.FindFile("dir/a.txt")->GetPathView(PathType::PSARC_PATH_TYPE_ABSOLUTE), "/dir/a.txt");
+}
+
+// ---------------------------------------------------------------------------
+// Archive — bulk insertion
+// ---------------------------------------------------------------------------
+
+TEST(Archive, AddFilesBuildsSameTreeAsAddFile) {
+  std::vector<std::string> paths = {"z.txt", "dir/b.txt", "/dir/a.txt", "dir/sub/c.txt", "other//d.txt", "PSArcManifest.bin"};
+
+  Archive single;
+  std::vector<File> batch;
+  for (const std::string& path : paths) {
+    single.AddFile(File(path, MakeBytes(path)));
+    batch.emplace_back(path, MakeBytes(path));
+  }
+
+  Archive bulk;
+  ASSERT_TRUE(bulk.AddFiles(std::move(batch)));
+
+  EXPECT_EQ(bulk.GetFileCount(), single.GetFileCount());
+  for (const std::string& path : paths) {
+    File* file = bulk.FindFile(path);
+    ASSERT_NE(file, nullptr) << path;
+    EXPECT_EQ(*file->GetUncompressedBytes(), MakeBytes(path));
+    EXPECT_NE(single.FindFile(path), nullptr) << path;
+  }
+
+  // The files of a directory are added in name order.
+  std::vector<std::string> order;
+  for (File* file : bulk)
+    order.push_back(file->GetPathString());
+  EXPECT_EQ(order, (std::vector<std::string> {"PSArcManifest.bin", "z.txt", "dir/a.txt", "dir/b.txt", "other/d.txt", "dir/sub/c.txt"}));
+}
+
+TEST(Archive, AddFileDropsTrailingSeparators) {
+  Archive archive;
+  ASSERT_TRUE(archive.AddFile(File("dir/", MakeBytes("a"))));
+  EXPECT_FALSE(archive.AddFile(File("/", MakeBytes("b"))));
+
+  std::vector<File> batch;
+  batch.emplace_back("other/c.txt//", MakeBytes("c"));
+  ASSERT_TRUE(archive.AddFiles(std::move(batch)));
+
+  // The stored paths match the positions of the files in the tree.
+  File* dir = archive.FindFile("dir");
+  ASSERT_NE(dir, nullptr);
+  EXPECT_EQ(dir->GetPathView(), "dir");
+  ASSERT_NE(archive.FindFile("other/c.txt"), nullptr);
+  EXPECT_EQ(archive.FindFile("other/c.txt")->GetPathView(), "other/c.txt");
+  EXPECT_EQ(archive.FindFilesWithPrefix("dir"), std::vector<File*> {dir});
+  EXPECT_EQ(archive.GetFileCount(), 2u);
+}
+
+TEST(Archive, AddFilesLaterDuplicateWins) {
+  Archive archive;
+  archive.AddFile(File("dir/existing.txt", MakeBytes("old")));
+
+  std::vector<File> batch;
+  batch.emplace_back("dir/x.txt", MakeBytes("first"));
+  batch.emplace_back("dir/existing.txt", MakeBytes("new"));
+  batch.emplace_back("/dir/x.txt", MakeBytes("second"));
+
+  ASSERT_TRUE(archive.AddFiles(std::move(batch)));
+  EXPECT_EQ(archive.GetFileCount(), 2u);
+  EXPECT_EQ(*archive.FindFile("dir/x.txt")->GetUncompressedBytes(), MakeBytes("second"));
+  EXPECT_EQ(*archive.FindFile("dir/existing.txt")->GetUncompressedBytes(), MakeBytes("new"));
+}
+
+TEST(Archive, StagedFilesFromSeveralThreads) {
+  Archive archive;
+  archive.AddFile(File("existing.txt", MakeBytes("existing")));
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < 8; t++) {
+    workers.emplace_back([&archive, t] {
+      for (int i = 0; i < 100; i++) {
+        const std::string name = "dir" + std::to_string(i % 10) + "/t" + std::to_string(t) + "_" + std::to_string(i) + ".bin";
+        archive.StageFile(File(name, MakeBytes(name)));
+      }
+    });
+  }
+
+  for (std::thread& worker : workers)
+    worker.join();
+
+  // Staged files only become visible once they are committed.
+  EXPECT_EQ(archive.GetFileCount(), 1u);
+  EXPECT_EQ(archive.FindFile("dir3/t5_13.bin"), nullptr);
+
+  ASSERT_TRUE(archive.CommitStagedFiles());
+  EXPECT_EQ(archive.GetFileCount(), 801u);
+  ASSERT_NE(archive.FindFile("dir3/t5_13.bin"), nullptr);
+  EXPECT_EQ(*archive.FindFile("dir3/t5_13.bin")->GetUncompressedBytes(), MakeBytes("dir3/t5_13.bin"));
+
+  // Committing again without staged files changes nothing.
+  EXPECT_TRUE(archive.CommitStagedFiles());
+  EXPECT_EQ(archive.GetFileCount(), 801u);
+}
+
+// ---------------------------------------------------------------------------
+// Archive — remove and rename
+// ---------------------------------------------------------------------------
+
+TEST(Archive, FilePointersStayValidWhileAdding) {
+  Archive archive;
+  archive.AddFile(File("dir/first.bin", MakeBytes("first")));
+  File* first = archive.FindFile("dir/first.bin");
+
+  for (int i = 0; i < 1000; i++) {
+    archive.AddFile(File("dir/file" + std::to_string(i) + ".bin", MakeBytes("x")));
+    archive.AddFile(File("dir/sub" + std::to_string(i) + "/file.bin", MakeBytes("y")));
+  }
+
+  EXPECT_EQ(archive.FindFile("dir/first.bin"), first);
+  EXPECT_EQ(*first->GetUncompressedBytes(), MakeBytes("first"));
+}
+
+TEST(Archive, RemoveFile) {
+  Archive archive;
+  archive.AddFile(File("PSArcManifest.bin", MakeBytes("manifest")));
+  for (int i = 0; i < 100; i++) {
+    archive.AddFile(File("dir/file" + std::to_string(i) + ".bin", MakeBytes(std::to_string(i))));
+  }
+
+  // Removing most files of a directory compacts its children, the remaining files must still be found.
+  for (int i = 0; i < 90; i++) {
+    EXPECT_TRUE(archive.RemoveFile("dir/file" + std::to_string(i) + ".bin"));
+  }
+
+  EXPECT_FALSE(archive.RemoveFile("dir/file0.bin"));
+  EXPECT_FALSE(archive.RemoveFile("missing/file.bin"));
+  EXPECT_EQ(archive.GetFileCount(), 10u);
+  EXPECT_EQ(archive.FindFile("dir/file10.bin"), nullptr);
+  ASSERT_NE(archive.FindFile("dir/file95.bin"), nullptr);
+  EXPECT_EQ(*archive.FindFile("dir/file95.bin")->GetUncompressedBytes(), MakeBytes("95"));
+
+  std::vector<std::string> paths;
+  for (File* file : archive) {
+    paths.push_back(file->GetPathString());
+  }
+
+  ASSERT_EQ(paths.size(), 11u);
+  EXPECT_EQ(paths.front(), "PSArcManifest.bin");
+  EXPECT_EQ(paths[1], "dir/file90.bin");
+  EXPECT_EQ(paths.back(), "dir/file99.bin");
+
+  EXPECT_TRUE(archive.RemoveFile("PSArcManifest.bin"));
+  EXPECT_EQ(archive.FindFile("PSArcManifest.bin"), nullptr);
+}
+
+TEST(Archive, RemoveDirectory) {
+  Archive archive;
+  archive.AddFile(File("keep/a.txt", MakeBytes("a")));
+  archive.AddFile(File("drop/b.txt", MakeBytes("b")));
+  archive.AddFile(File("drop/sub/c.txt", MakeBytes("c")));
+  archive.AddFile(File("drop/sub/deeper/d.txt", MakeBytes("d")));
+
+  EXPECT_TRUE(archive.RemoveDirectory("/drop"));
+  EXPECT_FALSE(archive.RemoveDirectory("drop"));
+  EXPECT_EQ(archive.GetFileCount(), 1u);
+  EXPECT_EQ(archive.FindFile("drop/sub/c.txt"), nullptr);
+  EXPECT_NE(archive.FindFile("keep/a.txt"), nullptr);
+  EXPECT_TRUE(archive.FindFilesWithPrefix("drop/").empty());
+
+  // The freed nodes are reused.
+  archive.AddFile(File("drop/e.txt", MakeBytes("e")));
+  EXPECT_EQ(archive.GetFileCount(), 2u);
+  EXPECT_NE(archive.FindFile("drop/e.txt"), nullptr);
+}
+
+TEST(Archive, RenameFile) {
+  Archive archive;
+  archive.AddFile(File("old/name.txt", MakeBytes("content")));
+  archive.AddFile(File("other/taken.txt", MakeBytes("taken")));
+  File* file = archive.FindFile("old/name.txt");
+
+  EXPECT_FALSE(archive.Rename("old/name.txt", "other/taken.txt"));
+  EXPECT_FALSE(archive.Rename("old/missing.txt", "new/missing.txt"));
+
+  ASSERT_TRUE(archive.Rename("old/name.txt", "new/dir/renamed.txt"));
+  EXPECT_EQ(archive.FindFile("old/name.txt"), nullptr);
+  EXPECT_EQ(archive.FindFile("new/dir/renamed.txt"), file);
+  EXPECT_EQ(file->GetPathString(), "new/dir/renamed.txt");
+  EXPECT_EQ(archive.GetFileCount(), 2u);
+  EXPECT_EQ(*file->GetUncompressedBytes(), MakeBytes("content"));
+
+  // Trailing separators are not stored, the manifest name can not be taken by a regular file.
+  ASSERT_TRUE(archive.Rename("new/dir/renamed.txt", "new/trailing.txt/"));
+  EXPECT_EQ(archive.FindFile("new/trailing.txt"), file);
+  EXPECT_EQ(file->GetPathString(), "new/trailing.txt");
+
+  EXPECT_FALSE(archive.Rename("new/trailing.txt", "PSArcManifest.bin"));
+  EXPECT_FALSE(archive.Rename("new/trailing.txt", "/PSArcManifest.bin"));
+  EXPECT_EQ(archive.FindFile("new/trailing.txt"), file);
+  EXPECT_FALSE(file->IsManifest());
+}
+
+TEST(Archive, RenameDirectory) {
+  Archive archive;
+  archive.AddFile(File("assets/a.txt", MakeBytes("a")));
+  archive.AddFile(File("/assets/sub/b.txt", MakeBytes("b")));
+  archive.AddFile(File("other/c.txt", MakeBytes("c")));
+
+  EXPECT_FALSE(archive.Rename("assets", "assets/sub/inner"));
+  EXPECT_FALSE(archive.Rename("assets", "other"));
+
+  ASSERT_TRUE(archive.Rename("assets", "data/assets2"));
+  EXPECT_EQ(archive.FindFile("assets/a.txt"), nullptr);
+  ASSERT_NE(archive.FindFile("data/assets2/a.txt"), nullptr);
+  ASSERT_NE(archive.FindFile("data/assets2/sub/b.txt"), nullptr);
+  EXPECT_EQ(archive.FindFile("data/assets2/sub/b.txt")->GetPathString(), "data/assets2/sub/b.txt");
+  EXPECT_EQ(archive.FindFilesWithPrefix("data/").size(), 2u);
+  EXPECT_EQ(archive.GetFileCount(), 3u);
+}
+
+TEST(Archive, RenameIgnoresEmptyPathComponents) {
+  Archive archive;
+  archive.AddFile(File("x/a/f.txt", MakeBytes("f")));
+  archive.AddFile(File("x/a/sub/g.txt", MakeBytes("g")));
+
+  ASSERT_TRUE(archive.Rename("x//a", "y//b/"));
+  ASSERT_NE(archive.FindFile("y/b/f.txt"), nullptr);
+  EXPECT_EQ(archive.FindFile("y/b/f.txt")->GetPathString(), "y/b/f.txt");
+  EXPECT_EQ(archive.FindFile("y/b/sub/g.txt")->GetPathString(), "y/b/sub/g.txt");
+  EXPECT_EQ(archive.FindFilesWithPrefix("y/").size(), 2u);
+  EXPECT_TRUE(archive.FindFilesWithPrefix("x/").empty());
+}
+
+TEST(Archive, RenameRejectsTargetsTakenByTheOtherKind) {
+  Archive archive;
+  archive.AddFile(File("d/a.txt", MakeBytes("a")));
+  archive.AddFile(File("e", MakeBytes("e")));
+
+  // Neither a directory onto a file nor a file onto a directory.
+  EXPECT_FALSE(archive.Rename("d", "e"));
+  EXPECT_FALSE(archive.Rename("e", "d"));
+  EXPECT_NE(archive.FindFile("d/a.txt"), nullptr);
+  EXPECT_NE(archive.FindFile("e"), nullptr);
+  EXPECT_EQ(archive.GetFileCount(), 2u);
+}
+
+TEST(Archive, FindFileIgnoreCaseAfterRemovingAndRenaming) {
+  Archive archive;
+  archive.AddFile(File("data/File.bin", MakeBytes("upper")));
+  archive.AddFile(File("data/file.bin", MakeBytes("lower")));
+  ASSERT_NE(archive.FindFile("DATA/FILE.BIN", PathType::PSARC_PATH_TYPE_IGNORECASE), nullptr);
+
+  // Once the exact match is gone the other spelling is found.
+  ASSERT_TRUE(archive.RemoveFile("data/file.bin"));
+  EXPECT_EQ(*archive.FindFile("data/file.bin", PathType::PSARC_PATH_TYPE_IGNORECASE)->GetUncompressedBytes(), MakeBytes("upper"));
+
+  ASSERT_TRUE(archive.Rename("data", "Other/Data"));
+  EXPECT_EQ(archive.FindFile("data/file.bin", PathType::PSARC_PATH_TYPE_IGNORECASE), nullptr);
+  EXPECT_EQ(archive.FindFile("other/data/FILE.bin", PathType::PSARC_PATH_TYPE_IGNORECASE), archive.FindFile("Other/Data/File.bin"));
+
+  ASSERT_TRUE(archive.Rename("Other/Data/File.bin", "Moved.bin"));
+  EXPECT_EQ(archive.FindFile("other/data/file.bin", PathType::PSARC_PATH_TYPE_IGNORECASE), nullptr);
+  EXPECT_EQ(archive.FindFile("MOVED.BIN", PathType::PSARC_PATH_TYPE_IGNORECASE), archive.FindFile("Moved.bin"));
+
+  archive.AddFile(File("Other/a.bin", MakeBytes("a")));
+  ASSERT_TRUE(archive.RemoveDirectory("Other"));
+  EXPECT_EQ(archive.FindFile("other/A.bin", PathType::PSARC_PATH_TYPE_IGNORECASE), nullptr);
+  EXPECT_NE(archive.FindFile("moved.bin", PathType::PSARC_PATH_TYPE_IGNORECASE), nullptr);
+}
+
+TEST(Archive, CopiesOwnTheirFiles) {
+  Archive original;
+  original.AddFile(File("dir/a.txt", MakeBytes("a")));
+  original.AddFile(File("dir/sub/b.txt", MakeBytes("b")));
+
+  Archive copy = original;
+  original.RemoveDirectory("dir");
+
+  EXPECT_EQ(original.GetFileCount(), 0u);
+  EXPECT_EQ(copy.GetFileCount(), 2u);
+  ASSERT_NE(copy.FindFile("dir/sub/b.txt"), nullptr);
+  EXPECT_EQ(*copy.FindFile("dir/sub/b.txt")->GetUncompressedBytes(), MakeBytes("b"));
+
+  Archive moved = std::move(copy);
+  EXPECT_EQ(moved.GetFileCount(), 2u);
+  EXPECT_NE(moved.FindFile("dir/a.txt"), nullptr);
+
+  original = moved;
+  EXPECT_EQ(original.GetFileCount(), 2u);
+  EXPECT_NE(original.FindFile("dir/a.txt"), original.FindFile("dir/sub/b.txt"));
+  EXPECT_NE(original.FindFile("dir/a.txt"), moved.FindFile("dir/a.txt"));
 }
 
 // ---------------------------------------------------------------------------
@@ -344,3 +819,342 @@ TEST(Archive, FindFileAbsoluteReturnsSameFile) {
   ASSERT_NE(abs, nullptr);
   EXPECT_EQ(rel, abs);  // both pointers point to the same File object
 }
+
+TEST(Archive, ManyFilesInOneDirectory) {
+  Archive archive;
+  for (size_t i = 0; i < 2000; ++i)
+    ASSERT_TRUE(archive.AddFile(File("dir/sub/file" + std::to_string(i) + ".bin", MakeBytes(std::to_string(i)))));
+
+  // Replacing an existing file must not change the count.
+  ASSERT_TRUE(archive.AddFile(File("/dir/sub/file7.bin", MakeBytes("replaced"))));
+  EXPECT_EQ(archive.GetFileCount(), 2000u);
+
+  for (size_t i = 0; i < 2000; i += 97) {
+    File* file = archive.FindFile("dir/sub/file" + std::to_string(i) + ".bin");
+    ASSERT_NE(file, nullptr);
+    EXPECT_EQ(*file->GetUncompressedBytes(), MakeBytes(std::to_string(i)));
+  }
+
+  EXPECT_EQ(*archive.FindFile("dir/sub/file7.bin")->GetUncompressedBytes(), MakeBytes("replaced"));
+  EXPECT_EQ(archive.FindFile("dir/sub/file2000.bin"), nullptr);
+  EXPECT_EQ(archive.FindFile("dir/missing/file1.bin"), nullptr);
+}
+
+TEST(Archive, FindFileIgnoreCase) {
+  Archive archive;
+  archive.AddFile(File("Textures/UI/Button.dds", MakeBytes("button")));
+  archive.AddFile(File("sounds/click.wem", MakeBytes("click")));
+
+  File* exact = archive.FindFile("Textures/UI/Button.dds");
+  ASSERT_NE(exact, nullptr);
+  EXPECT_EQ(archive.FindFile("textures/ui/button.dds", PathType::PSARC_PATH_TYPE_IGNORECASE), exact);
+  EXPECT_EQ(archive.FindFile("/TEXTURES/ui/BUTTON.DDS", PathType::PSARC_PATH_TYPE_IGNORECASE), exact);
+  EXPECT_EQ(archive.FindFile("textures/ui/button.dds"), nullptr);
+  EXPECT_EQ(archive.FindFile("textures/ui/missing.dds", PathType::PSARC_PATH_TYPE_IGNORECASE), nullptr);
+
+  // Files added after the first lookup are found as well.
+  archive.AddFile(File("Models/Rock.mesh", MakeBytes("rock")));
+  EXPECT_NE(archive.FindFile("models/rock.MESH", PathType::PSARC_PATH_TYPE_IGNORECASE), nullptr);
+}
+
+TEST(Archive, FindFileIgnoreCasePrefersExactMatch) {
+  Archive archive;
+  archive.AddFile(File("data/File.bin", MakeBytes("upper")));
+  archive.AddFile(File("data/file.bin", MakeBytes("lower")));
+
+  EXPECT_EQ(*archive.FindFile("data/file.bin", PathType::PSARC_PATH_TYPE_IGNORECASE)->GetUncompressedBytes(), MakeBytes("lower"));
+  EXPECT_EQ(*archive.FindFile("data/File.bin", PathType::PSARC_PATH_TYPE_IGNORECASE)->GetUncompressedBytes(), MakeBytes("upper"));
+  EXPECT_NE(archive.FindFile("DATA/FILE.BIN", PathType::PSARC_PATH_TYPE_IGNORECASE), nullptr);
+}
+
+TEST(Archive, FindFileIgnoreCaseAfterAddingFiles) {
+  Archive archive;
+  archive.AddFile(File("data/File.bin", MakeBytes("upper")));
+  archive.AddFile(File("PSArcManifest.bin", MakeBytes("manifest")));
+  ASSERT_NE(archive.FindFile("DATA/FILE.BIN", PathType::PSARC_PATH_TYPE_IGNORECASE), nullptr);
+
+  // Files added after the first lookup are found right away, also when they only differ in case from an existing file.
+  archive.AddFile(File("data/file.bin", MakeBytes("lower")));
+  std::vector<File> batch;
+  batch.emplace_back("Other/Thing.bin", MakeBytes("thing"));
+  archive.AddFiles(std::move(batch));
+
+  EXPECT_EQ(*archive.FindFile("data/file.bin", PathType::PSARC_PATH_TYPE_IGNORECASE)->GetUncompressedBytes(), MakeBytes("lower"));
+  EXPECT_EQ(*archive.FindFile("data/File.bin", PathType::PSARC_PATH_TYPE_IGNORECASE)->GetUncompressedBytes(), MakeBytes("upper"));
+  EXPECT_EQ(archive.FindFile("other/thing.BIN", PathType::PSARC_PATH_TYPE_IGNORECASE), archive.FindFile("Other/Thing.bin"));
+
+  // The manifest is not part of the tree but is matched in any case as well.
+  File* manifest = archive.FindFile("PSArcManifest.bin");
+  ASSERT_NE(manifest, nullptr);
+  EXPECT_EQ(archive.FindFile("psarcmanifest.BIN", PathType::PSARC_PATH_TYPE_IGNORECASE), manifest);
+  EXPECT_EQ(archive.FindFile("/PSArcManifest.bin", PathType::PSARC_PATH_TYPE_IGNORECASE), manifest);
+}
+
+// ---------------------------------------------------------------------------
+// Archive — memory budget
+// ---------------------------------------------------------------------------
+
+TEST(Archive, MemoryBudgetEvictsLeastRecentlyUsed) {
+  CountingSource first(std::vector<byte>(1000, 1));
+  CountingSource second(std::vector<byte>(1000, 2));
+
+  Archive archive;
+  archive.SetMemoryBudget(1500);
+  archive.AddFile(File("first.bin", &first));
+  archive.AddFile(File("second.bin", &second));
+
+  File* firstFile  = archive.FindFile("first.bin");
+  File* secondFile = archive.FindFile("second.bin");
+  ASSERT_NE(firstFile, nullptr);
+  ASSERT_NE(secondFile, nullptr);
+
+  EXPECT_EQ(firstFile->GetUncompressedBytes()->size(), 1000u);
+  EXPECT_EQ(secondFile->GetUncompressedBytes()->size(), 1000u);
+
+  // Loading the second file exceeded the budget, the first one has to be read again.
+  EXPECT_EQ(secondFile->GetUncompressedBytes()->front(), 2);
+  EXPECT_EQ(second.reads, 1u);
+  EXPECT_EQ(firstFile->GetUncompressedBytes()->front(), 1);
+  EXPECT_EQ(first.reads, 2u);
+}
+
+TEST(Archive, MemoryBudgetKeepsReferencedAndOwnedData) {
+  CountingSource first(std::vector<byte>(1000, 3));
+  CountingSource second(std::vector<byte>(1000, 5));
+
+  Archive archive;
+  archive.AddFile(File("owned.bin", std::vector<byte>(1000, 4)));
+  archive.AddFile(File("first.bin", &first));
+  archive.AddFile(File("second.bin", &second));
+  archive.SetMemoryBudget(1);
+
+  std::shared_ptr<const std::vector<byte>> held = archive.FindFile("first.bin")->GetUncompressedBytes();
+  archive.FindFile("second.bin")->LoadUncompressedBytes();
+
+  // The first file was evicted but the bytes held by the caller stay valid and are reused instead of read again.
+  EXPECT_EQ(held->size(), 1000u);
+  EXPECT_EQ(held->back(), 3);
+  EXPECT_EQ(archive.FindFile("first.bin")->GetUncompressedBytes()->back(), 3);
+  EXPECT_EQ(first.reads, 1u);
+
+  held.reset();
+  archive.FindFile("second.bin")->LoadUncompressedBytes();
+  EXPECT_EQ(archive.FindFile("first.bin")->GetUncompressedBytes()->back(), 3);
+  EXPECT_EQ(first.reads, 2u);
+
+  // Data without a source can not be reloaded and is never evicted.
+  EXPECT_EQ(archive.FindFile("owned.bin")->GetUncompressedBytes()->back(), 4);
+}
+
+TEST(Archive, SizeQueriesDoNotTouchTheCache) {
+  CountingSource first(std::vector<byte>(1000, 6));
+  CountingSource second(std::vector<byte>(1000, 7));
+
+  Archive archive;
+  archive.SetMemoryBudget(1500);
+  archive.AddFile(File("first.bin", &first));
+  archive.AddFile(File("second.bin", &second));
+
+  File* firstFile  = archive.FindFile("first.bin");
+  File* secondFile = archive.FindFile("second.bin");
+  ASSERT_NE(firstFile, nullptr);
+  ASSERT_NE(secondFile, nullptr);
+
+  std::shared_ptr<const std::vector<byte>> held = firstFile->GetUncompressedBytes();
+  secondFile->LoadUncompressedBytes();
+
+  // The first file was evicted while it is held, querying it must not hand it back to the cache and evict the second file.
+  EXPECT_TRUE(firstFile->IsUncompressedSizeAvailable());
+  EXPECT_EQ(firstFile->GetUncompressedSize(), 1000u);
+  EXPECT_FALSE(firstFile->IsCompressedSizeAvailable());
+
+  secondFile->LoadUncompressedBytes();
+  EXPECT_EQ(second.reads, 1u);
+}
+
+TEST(File, GetCompressedSizeWithoutContent) {
+  File f("empty.bin", static_cast<FileSourceProvider*>(nullptr));
+  EXPECT_EQ(f.GetUncompressedSize(), 0u);
+  EXPECT_FALSE(f.IsUncompressedSizeAvailable());
+  EXPECT_EQ(f.GetCompressedSize(), 0u);
+}
+
+// ---------------------------------------------------------------------------
+// File — block granular sources
+// ---------------------------------------------------------------------------
+
+TEST(File, SourceBlocksAreStreamed) {
+  std::vector<byte> data(3500);
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<byte>(i % 37);
+
+  // The block size of the source differs from the one used for compression.
+  BlockOnlySource source(data, 1000);
+  File f("streamed.bin", &source);
+
+  std::vector<byte> direct(data.size());
+  ASSERT_TRUE(f.DecompressInto(direct));
+  EXPECT_EQ(direct, data);
+
+  std::vector<byte> secondBlock(1000);
+  ASSERT_TRUE(f.DecompressInto(secondBlock, 1, 1));
+  EXPECT_TRUE(std::equal(secondBlock.begin(), secondBlock.end(), data.begin() + 1000));
+
+  f.Compress(CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 1024);
+  EXPECT_EQ(f.GetCompressedBlocks().size(), 4u);
+  EXPECT_EQ(f.GetBlockCount(), 4u);
+  EXPECT_EQ(f.GetMaxBlockSize(), 1024u);
+
+  std::vector<byte> roundTrip(data.size());
+  ASSERT_TRUE(f.DecompressInto(roundTrip));
+  EXPECT_EQ(roundTrip, data);
+  EXPECT_EQ(source.dataReads, 0u);
+}
+
+TEST(File, ReadCompressedBlocksWithRunningOffset) {
+  std::vector<byte> data(5000);
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<byte>((i * 7) % 251);
+
+  File f("blocks.bin", data);
+  f.Compress(CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 1024);
+
+  const std::vector<BlockDescriptor> blocks = f.GetCompressedBlocks();
+  ASSERT_EQ(blocks.size(), 5u);
+
+  std::vector<byte> stored;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    std::vector<byte> blockBytes(blocks[i].compressedSize);
+    ASSERT_TRUE(f.ReadCompressedBlock(i, stored.size(), blockBytes));
+    stored.insert(stored.end(), blockBytes.begin(), blockBytes.end());
+  }
+  EXPECT_EQ(stored, *f.GetCompressedBytes());
+
+  // An offset past the stored bytes is rejected.
+  std::vector<byte> lastBlock(blocks.back().compressedSize);
+  EXPECT_FALSE(f.ReadCompressedBlock(blocks.size() - 1, stored.size(), lastBlock));
+}
+
+TEST(File, SourcesWithoutBlockAccessAreReadOnce) {
+  std::vector<byte> data(3 * 65536 + 100);
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<byte>(i % 37);
+
+  CountingSource source(data);
+  File f("whole.bin", &source);
+
+  ASSERT_EQ(f.GetBlockCount(), 4u);
+  for (size_t block = 0; block < 4; ++block) {
+    std::vector<byte> blockData(std::min<size_t>(65536, data.size() - block * 65536));
+    ASSERT_TRUE(f.DecompressInto(blockData, block, 1));
+    EXPECT_TRUE(std::equal(blockData.begin(), blockData.end(), data.begin() + block * 65536));
+  }
+
+  f.Compress(CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 65536);
+  EXPECT_EQ(f.GetCompressedBlocks().size(), 4u);
+  EXPECT_EQ(source.reads, 1u);
+}
+
+// ---------------------------------------------------------------------------
+// BufferPool
+// ---------------------------------------------------------------------------
+
+TEST(BufferPool, ReleasedBuffersAreReused) {
+  BufferPool pool(1024 * 1024, 64 * 1024);
+
+  std::vector<byte> buffer = pool.Acquire(4096);
+  ASSERT_GE(buffer.capacity(), 4096u);
+  const byte* allocation = buffer.data();
+
+  pool.Release(std::move(buffer));
+  EXPECT_GE(pool.GetPooledBytes(), 4096u);
+
+  std::vector<byte> reused = pool.Acquire(3000);
+  EXPECT_EQ(reused.data(), allocation);
+  EXPECT_TRUE(reused.empty());
+  EXPECT_EQ(pool.GetPooledBytes(), 0u);
+}
+
+TEST(BufferPool, OversizedBuffersAreFreed) {
+  BufferPool pool(1024 * 1024, 64 * 1024);
+
+  pool.Release(std::vector<byte>(128 * 1024));
+  EXPECT_EQ(pool.GetPooledBytes(), 0u);
+}
+
+TEST(BufferPool, AcquirePicksAFittingSizeClass) {
+  BufferPool pool(1024 * 1024, 256 * 1024);
+
+  std::vector<byte> small     = pool.Acquire(1000);
+  std::vector<byte> large     = pool.Acquire(10 * 1024);
+  const byte* smallAllocation = small.data();
+  const byte* largeAllocation = large.data();
+  pool.Release(std::move(small));
+  pool.Release(std::move(large));
+
+  // The small buffer does not fit, the next larger size class is used.
+  std::vector<byte> fitting = pool.Acquire(5000);
+  EXPECT_EQ(fitting.data(), largeAllocation);
+  EXPECT_GE(fitting.capacity(), 5000u);
+
+  std::vector<byte> remaining = pool.Acquire(500);
+  EXPECT_EQ(remaining.data(), smallAllocation);
+  EXPECT_EQ(pool.GetPooledBytes(), 0u);
+}
+
+TEST(BufferPool, AcquireLeavesMuchLargerBuffersPooled) {
+  BufferPool pool(64 * 1024 * 1024, 16 * 1024 * 1024);
+
+  std::vector<byte> large     = pool.Acquire(16 * 1024 * 1024);
+  const byte* largeAllocation = large.data();
+  pool.Release(std::move(large));
+
+  // A small request allocates a buffer of its own instead of taking one many size classes above it.
+  std::vector<byte> small = pool.Acquire(100);
+  EXPECT_NE(small.data(), largeAllocation);
+  EXPECT_GE(pool.GetPooledBytes(), 16u * 1024 * 1024);
+
+  std::vector<byte> fitting = pool.Acquire(10 * 1024 * 1024);
+  EXPECT_EQ(fitting.data(), largeAllocation);
+  EXPECT_EQ(pool.GetPooledBytes(), 0u);
+}
+
+TEST(BufferPool, SetLimitsFreesExcessBuffers) {
+  BufferPool pool(1024 * 1024, 256 * 1024);
+
+  std::vector<byte> large  = pool.Acquire(100 * 1024);
+  std::vector<byte> first  = pool.Acquire(4096);
+  std::vector<byte> second = pool.Acquire(4096);
+  pool.Release(std::move(large));
+  pool.Release(std::move(first));
+  pool.Release(std::move(second));
+  ASSERT_GE(pool.GetPooledBytes(), 108u * 1024);
+
+  pool.SetLimits(1024 * 1024, 64 * 1024);
+  EXPECT_GE(pool.GetPooledBytes(), 8192u);
+  EXPECT_LT(pool.GetPooledBytes(), 64u * 1024);
+
+  pool.SetLimits(6000, 64 * 1024);
+  EXPECT_LE(pool.GetPooledBytes(), 6000u);
+  EXPECT_GT(pool.GetPooledBytes(), 0u);
+}
+
+TEST(File, CompressReusesPooledBuffers) {
+  std::vector<byte> data(20000);
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<byte>(i % 13);
+
+  File first("first.bin", data);
+  first.Compress(CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 4096);
+  const size_t pooledBefore = BufferPool::Get().GetPooledBytes();
+  first.ClearCompressedBytes();
+  EXPECT_GT(BufferPool::Get().GetPooledBytes(), pooledBefore);
+
+  File second("second.bin", data);
+  second.Compress(CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 4096);
+  EXPECT_EQ(BufferPool::Get().GetPooledBytes(), pooledBefore);
+
+  std::vector<byte> roundTrip(data.size());
+  ASSERT_TRUE(second.DecompressInto(roundTrip));
+  EXPECT_EQ(roundTrip, data);
+}
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <thread>
 #include <vector>
 
 #include "psarc_compression.hpp"
@@ -33,12 +34,11 @@ std::vector<byte> MakeIncompressibleBuffer(size_t size) {
 
 void RunZlibRoundTrip(const std::vector<byte>& original, size_t blockSize) {
   std::vector<byte> compressed;
-  std::vector<size_t> compressedBlockSizes;
-  ZLIBCompress(compressed, original, compressedBlockSizes, blockSize, blockSize * 2);
+  std::vector<BlockDescriptor> blocks;
+  ZLIBCompress(compressed, original, blocks, blockSize, blockSize * 2);
 
   std::vector<byte> decompressed;
-  std::vector<bool> blockIsCompressed(compressedBlockSizes.size(), true);
-  ZLIBDecompress(decompressed, compressed, compressedBlockSizes, blockIsCompressed);
+  ZLIBDecompress(decompressed, compressed, blocks);
 
   ASSERT_EQ(decompressed.size(), original.size());
   EXPECT_EQ(decompressed, original);
@@ -46,12 +46,11 @@ void RunZlibRoundTrip(const std::vector<byte>& original, size_t blockSize) {
 
 void RunLzmaRoundTrip(const std::vector<byte>& original, size_t blockSize) {
   std::vector<byte> compressed;
-  std::vector<size_t> compressedBlockSizes;
-  LZMACompress(compressed, original, compressedBlockSizes, blockSize, blockSize * 2);
+  std::vector<BlockDescriptor> blocks;
+  LZMACompress(compressed, original, blocks, blockSize, blockSize * 2);
 
   std::vector<byte> decompressed;
-  std::vector<bool> blockIsCompressed(compressedBlockSizes.size(), true);
-  LZMADecompress(decompressed, compressed, compressedBlockSizes, blockIsCompressed);
+  LZMADecompress(decompressed, compressed, blocks);
 
   ASSERT_EQ(decompressed.size(), original.size());
   EXPECT_EQ(decompressed, original);
@@ -118,6 +117,48 @@ TEST(LzmaCompression, MultiBlockRoundTrip) {
   RunLzmaRoundTrip(buf, 1024);
 }
 
+TEST(LzmaCompression, ReusedEncoderMatchesFreshEncoder) {
+  auto first  = MakeIncompressibleBuffer(3000);
+  auto second = MakeCompressibleBuffer(10 * 1024);
+
+  // Each thread keeps its own encoder, a new thread compresses with a freshly created one.
+  std::vector<byte> fresh;
+  std::vector<BlockDescriptor> freshBlocks;
+  std::thread([&]() { LZMACompress(fresh, second, freshBlocks, 4096, 4096); }).join();
+
+  std::vector<byte> warmup;
+  std::vector<BlockDescriptor> warmupBlocks;
+  LZMACompress(warmup, first, warmupBlocks, 1024, 1024);
+
+  std::vector<byte> reused;
+  std::vector<BlockDescriptor> reusedBlocks;
+  LZMACompress(reused, second, reusedBlocks, 4096, 4096);
+
+  EXPECT_EQ(reused, fresh);
+  ASSERT_EQ(reusedBlocks.size(), freshBlocks.size());
+  for (size_t i = 0; i < reusedBlocks.size(); ++i)
+    EXPECT_EQ(reusedBlocks[i].compressedSize, freshBlocks[i].compressedSize);
+}
+
+TEST(LzmaCompression, DecoderHandlesChangingProps) {
+  auto buf = MakeCompressibleBuffer(6 * 1024);
+
+  // The dictionary size in the props follows the block size, hence both streams use different props.
+  std::vector<byte> small, large;
+  std::vector<BlockDescriptor> smallBlocks, largeBlocks;
+  LZMACompress(small, buf, smallBlocks, 1024, 1024);
+  LZMACompress(large, buf, largeBlocks, 4096, 4096);
+
+  for (int i = 0; i < 2; ++i) {
+    std::vector<byte> decompressed;
+    ASSERT_EQ(LZMADecompress(decompressed, large, largeBlocks, buf.size()), buf.size());
+    EXPECT_EQ(decompressed, buf);
+
+    ASSERT_EQ(LZMADecompress(decompressed, small, smallBlocks, buf.size()), buf.size());
+    EXPECT_EQ(decompressed, buf);
+  }
+}
+
 // ---------------------------------------------------------------------------
 // Cross-codec: compressed output is different between ZLIB and LZMA
 // ---------------------------------------------------------------------------
@@ -126,12 +167,12 @@ TEST(CompressionCodecs, ZlibAndLzmaProduceDifferentCompressedBytes) {
   auto original = MakeCompressibleBuffer(8 * 1024);
 
   std::vector<byte> zlibOut;
-  std::vector<size_t> zlibSizes;
-  ZLIBCompress(zlibOut, original, zlibSizes, 65536, 65536 * 2);
+  std::vector<BlockDescriptor> zlibBlocks;
+  ZLIBCompress(zlibOut, original, zlibBlocks, 65536, 65536 * 2);
 
   std::vector<byte> lzmaOut;
-  std::vector<size_t> lzmaSizes;
-  LZMACompress(lzmaOut, original, lzmaSizes, 65536, 65536 * 2);
+  std::vector<BlockDescriptor> lzmaBlocks;
+  LZMACompress(lzmaOut, original, lzmaBlocks, 65536, 65536 * 2);
 
   EXPECT_NE(zlibOut, lzmaOut);
 }
@@ -225,19 +266,19 @@ TEST(LzmaCompression, BlockSizeLargerThanInput) {
 TEST(ZlibCompression, CompressedBlockSizesNonZero) {
   auto original = MakeCompressibleBuffer(4 * 1024);
   std::vector<byte> compressed;
-  std::vector<size_t> blockSizes;
-  ZLIBCompress(compressed, original, blockSizes, 1024, 1024 * 2);
-  for (size_t sz : blockSizes)
-    EXPECT_GT(sz, 0u);
+  std::vector<BlockDescriptor> blocks;
+  ZLIBCompress(compressed, original, blocks, 1024, 1024 * 2);
+  for (const BlockDescriptor& block : blocks)
+    EXPECT_GT(block.compressedSize, 0u);
 }
 
 TEST(LzmaCompression, CompressedBlockSizesNonZero) {
   auto original = MakeCompressibleBuffer(4 * 1024);
   std::vector<byte> compressed;
-  std::vector<size_t> blockSizes;
-  LZMACompress(compressed, original, blockSizes, 1024, 1024 * 2);
-  for (size_t sz : blockSizes)
-    EXPECT_GT(sz, 0u);
+  std::vector<BlockDescriptor> blocks;
+  LZMACompress(compressed, original, blocks, 1024, 1024 * 2);
+  for (const BlockDescriptor& block : blocks)
+    EXPECT_GT(block.compressedSize, 0u);
 }
 
 // ---------------------------------------------------------------------------
@@ -249,9 +290,9 @@ TEST(ZlibCompression, BlockCountMatchesCeil) {
   const size_t inputSize = 3 * blockSize + 1;  // 4 blocks expected
   auto original          = MakeCompressibleBuffer(inputSize);
   std::vector<byte> compressed;
-  std::vector<size_t> blockSizes;
-  ZLIBCompress(compressed, original, blockSizes, blockSize, blockSize * 2);
-  EXPECT_EQ(blockSizes.size(), 4u);
+  std::vector<BlockDescriptor> blocks;
+  ZLIBCompress(compressed, original, blocks, blockSize, blockSize * 2);
+  EXPECT_EQ(blocks.size(), 4u);
 }
 
 TEST(LzmaCompression, BlockCountMatchesCeil) {
@@ -259,23 +300,93 @@ TEST(LzmaCompression, BlockCountMatchesCeil) {
   const size_t inputSize = 3 * blockSize + 1;
   auto original          = MakeCompressibleBuffer(inputSize);
   std::vector<byte> compressed;
-  std::vector<size_t> blockSizes;
-  LZMACompress(compressed, original, blockSizes, blockSize, blockSize * 2);
-  EXPECT_EQ(blockSizes.size(), 4u);
+  std::vector<BlockDescriptor> blocks;
+  LZMACompress(compressed, original, blocks, blockSize, blockSize * 2);
+  EXPECT_EQ(blocks.size(), 4u);
 }
 
 // ---------------------------------------------------------------------------
-// Partial-block decompression: blockIsCompressed flag set to false
+// Partial-block decompression: isCompressed flag set to false
 // ---------------------------------------------------------------------------
 
 TEST(ZlibCompression, UncompressedBlockPassthrough) {
-  // Build a single raw block and pass it through with blockIsCompressed=false.
+  // Build a single raw block and pass it through with isCompressed=false.
   std::vector<byte> original          = MakeCompressibleBuffer(512);
-  std::vector<size_t> blockSizes      = {original.size()};
-  std::vector<bool> blockIsCompressed = {false};
+  std::vector<BlockDescriptor> blocks = {BlockDescriptor {uint32_t(original.size()), false}};
 
   std::vector<byte> decompressed;
-  ZLIBDecompress(decompressed, original, blockSizes, blockIsCompressed);
+  ZLIBDecompress(decompressed, original, blocks);
+
+  EXPECT_EQ(decompressed, original);
+}
+
+// ---------------------------------------------------------------------------
+// Block classification: a block is stored iff its size equals its uncompressed size
+// ---------------------------------------------------------------------------
 
+TEST(BlockClassification, IncompressibleFullBlocksAreStored) {
+  const size_t blockSize = 1024;
+  auto original          = MakeIncompressibleBuffer(3 * blockSize);
+  std::vector<byte> compressed;
+  std::vector<BlockDescriptor> blocks;
+  LZMACompress(compressed, original, blocks, blockSize, blockSize);
+
+  ASSERT_EQ(blocks.size(), GetBlockCount(original.size(), blockSize));
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    EXPECT_EQ(blocks[i].compressedSize, GetUncompressedBlockSize(i, original.size(), blockSize)) << "Block " << i;
+    EXPECT_FALSE(blocks[i].isCompressed) << "Block " << i;
+  }
+}
+
+TEST(ZlibCompression, KnownBlockSizesRoundTrip) {
+  const size_t blockSize = 1024;
+  auto original          = MakeCompressibleBuffer(5 * blockSize + 7);
+  std::vector<byte> compressed;
+  std::vector<BlockDescriptor> blocks;
+  ZLIBCompress(compressed, original, blocks, blockSize, blockSize);
+
+  std::vector<byte> decompressed;
+  EXPECT_EQ(ZLIBDecompress(decompressed, compressed, blocks, original.size(), blockSize), original.size());
   EXPECT_EQ(decompressed, original);
 }
+
+// ---------------------------------------------------------------------------
+// Block compression cache: repeated blocks are compressed once
+// ---------------------------------------------------------------------------
+
+TEST(BlockCompressionCache, RepeatedBlocksAreReused) {
+  const size_t blockSize = 1024;
+  auto unique            = MakeIncompressibleBuffer(blockSize);
+  auto compressible      = MakeCompressibleBuffer(blockSize);
+
+  // compressible, unique, compressible, unique, compressible + partial tail.
+  std::vector<byte> original;
+  for (int i = 0; i < 5; ++i) {
+    const auto& block = (i % 2 == 0) ? compressible : unique;
+    original.insert(original.end(), block.begin(), block.end());
+  }
+  original.insert(original.end(), compressible.begin(), compressible.begin() + 100);
+
+  for (CompressionType type : {CompressionType::PSARC_COMPRESSION_TYPE_LZMA, CompressionType::PSARC_COMPRESSION_TYPE_ZLIB}) {
+    BlockCompressionCache cache(type, 1024 * 1024);
+
+    std::vector<byte> expected, cached;
+    std::vector<BlockDescriptor> expectedBlocks, cachedBlocks;
+    if (type == CompressionType::PSARC_COMPRESSION_TYPE_LZMA) {
+      LZMACompress(expected, original, expectedBlocks, blockSize, blockSize);
+      LZMACompress(cached, original, cachedBlocks, blockSize, blockSize, &cache);
+    }
+    else {
+      ZLIBCompress(expected, original, expectedBlocks, blockSize, blockSize);
+      ZLIBCompress(cached, original, cachedBlocks, blockSize, blockSize, &cache);
+    }
+
+    EXPECT_EQ(cache.GetHitCount(), 3u);
+    EXPECT_EQ(cached, expected);
+    ASSERT_EQ(cachedBlocks.size(), expectedBlocks.size());
+    for (size_t i = 0; i < cachedBlocks.size(); ++i) {
+      EXPECT_EQ(cachedBlocks[i].compressedSize, expectedBlocks[i].compressedSize);
+      EXPECT_EQ(cachedBlocks[i].isCompressed, expectedBlocks[i].isCompressed);
+    }
+  }
+}
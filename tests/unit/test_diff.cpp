@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "psarc_archive.hpp"
+#include "psarc_diff.hpp"
+#include "psarc_error.hpp"
+#include "psarc_types.hpp"
+
+using namespace PSArc;
+
+namespace {
+
+std::vector<byte> MakeBytes(std::string s) {
+  return std::vector<byte>(s.begin(), s.end());
+}
+
+std::vector<byte> MakePattern(size_t size, uint32_t seed) {
+  std::vector<byte> data(size);
+  for (size_t i = 0; i < size; i++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    data[i] = byte((seed & 0x3) + 'a');
+  }
+  return data;
+}
+
+FileDiffStatus StatusOf(const ArchiveDiff& diff, const std::string& path) {
+  for (const FileDiff& file : diff.files) {
+    if (file.path == path)
+      return file.status;
+  }
+
+  ADD_FAILURE() << "Missing diff entry for " << path;
+  return PSARC_FILE_DIFF_STATUS_UNCHANGED;
+}
+
+}  // anonymous namespace
+
+// ---------------------------------------------------------------------------
+// DiffArchives
+// ---------------------------------------------------------------------------
+
+TEST(DiffArchives, ReportsAddedRemovedChangedAndUnchanged) {
+  Archive oldArchive;
+  oldArchive.AddFile(File("PSArcManifest.bin", MakeBytes("manifest")));
+  oldArchive.AddFile(File("same.txt", MakeBytes("same")));
+  oldArchive.AddFile(File("dir/edited.txt", MakeBytes("edit")));
+  oldArchive.AddFile(File("dir/grown.txt", MakeBytes("grow")));
+  oldArchive.AddFile(File("removed.txt", MakeBytes("removed")));
+
+  Archive newArchive;
+  newArchive.AddFile(File("PSArcManifest.bin", MakeBytes("other manifest")));
+  newArchive.AddFile(File("same.txt", MakeBytes("same")));
+  newArchive.AddFile(File("dir/edited.txt", MakeBytes("EDIT")));
+  newArchive.AddFile(File("dir/grown.txt", MakeBytes("grown")));
+  newArchive.AddFile(File("dir/added.txt", MakeBytes("added")));
+
+  ArchiveDiff diff;
+  ASSERT_EQ(DiffArchives(oldArchive, newArchive, diff), PSARC_STATUS_OK);
+
+  ASSERT_EQ(diff.files.size(), 5u);
+  EXPECT_EQ(diff.files.front().path, "dir/added.txt");
+  EXPECT_EQ(StatusOf(diff, "same.txt"), PSARC_FILE_DIFF_STATUS_UNCHANGED);
+  EXPECT_EQ(StatusOf(diff, "dir/edited.txt"), PSARC_FILE_DIFF_STATUS_CHANGED);
+  EXPECT_EQ(StatusOf(diff, "dir/grown.txt"), PSARC_FILE_DIFF_STATUS_CHANGED);
+  EXPECT_EQ(StatusOf(diff, "removed.txt"), PSARC_FILE_DIFF_STATUS_REMOVED);
+  EXPECT_EQ(StatusOf(diff, "dir/added.txt"), PSARC_FILE_DIFF_STATUS_ADDED);
+
+  EXPECT_EQ(diff.addedCount, 1u);
+  EXPECT_EQ(diff.removedCount, 1u);
+  EXPECT_EQ(diff.changedCount, 2u);
+  EXPECT_EQ(diff.unchangedCount, 1u);
+  // The grown file differs in size, its content is never looked at.
+  EXPECT_EQ(diff.comparedContentCount, 2u);
+}
+
+TEST(DiffArchives, ComparesStoredBlocksOfCompressedFiles) {
+  const std::vector<byte> content = MakePattern(200000, 0x1234ABCDu);
+  std::vector<byte> edited        = content;
+  edited[150000]                  = byte(edited[150000] == 'a' ? 'b' : 'a');
+
+  Archive oldArchive;
+  oldArchive.AddFile(File("same.bin", content));
+  oldArchive.AddFile(File("edited.bin", content));
+
+  Archive newArchive;
+  newArchive.AddFile(File("same.bin", content));
+  newArchive.AddFile(File("edited.bin", edited));
+
+  for (Archive* archive : {&oldArchive, &newArchive}) {
+    for (File* file : *archive) {
+      file->Compress(CompressionType::PSARC_COMPRESSION_TYPE_ZLIB, 65536);
+      file->ClearUncompressedBytes();
+      ASSERT_TRUE(file->HasCompressedBlocks());
+    }
+  }
+
+  ArchiveDiff diff;
+  ASSERT_EQ(DiffArchives(oldArchive, newArchive, diff), PSARC_STATUS_OK);
+  EXPECT_EQ(StatusOf(diff, "same.bin"), PSARC_FILE_DIFF_STATUS_UNCHANGED);
+  EXPECT_EQ(StatusOf(diff, "edited.bin"), PSARC_FILE_DIFF_STATUS_CHANGED);
+  EXPECT_EQ(diff.unchangedCount, 1u);
+  EXPECT_EQ(diff.changedCount, 1u);
+}
+
+TEST(DiffArchives, EmptyArchives) {
+  Archive oldArchive;
+  Archive newArchive;
+
+  ArchiveDiff diff;
+  ASSERT_EQ(DiffArchives(oldArchive, newArchive, diff), PSARC_STATUS_OK);
+  EXPECT_TRUE(diff.files.empty());
+}
@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "psarc_archive.hpp"
+#include "psarc_path_index.hpp"
+
+using namespace PSArc;
+
+namespace {
+
+std::vector<byte> MakeBytes(std::string s) {
+  return std::vector<byte>(s.begin(), s.end());
+}
+
+std::vector<std::string> PathsOf(const std::vector<File*>& files) {
+  std::vector<std::string> paths;
+  for (File* file : files)
+    paths.push_back(file->GetPathString());
+  return paths;
+}
+
+Archive MakeArchive() {
+  Archive archive;
+  archive.AddFile(File("textures/ui/button.dds", MakeBytes("1")));
+  archive.AddFile(File("textures/ui/icons/star.dds", MakeBytes("2")));
+  archive.AddFile(File("textures/ui2/panel.dds", MakeBytes("3")));
+  archive.AddFile(File("textures/world/rock.dds", MakeBytes("4")));
+  archive.AddFile(File("/sounds/ui/click.wem", MakeBytes("5")));
+  archive.AddFile(File("readme.txt", MakeBytes("6")));
+  return archive;
+}
+
+}  // anonymous namespace
+
+// ---------------------------------------------------------------------------
+// PathIndex — lookup
+// ---------------------------------------------------------------------------
+
+TEST(PathIndex, FindsEveryPathAcrossBlocks) {
+  Archive archive;
+  for (size_t i = 0; i < 500; ++i)
+    archive.AddFile(File("data/level" + std::to_string(i % 7) + "/chunk" + std::to_string(i) + ".bin", MakeBytes(std::to_string(i))));
+
+  const PathIndex& index = archive.GetPathIndex();
+  ASSERT_EQ(index.GetSize(), 500u);
+
+  for (size_t i = 0; i < 500; ++i) {
+    const std::string path = "data/level" + std::to_string(i % 7) + "/chunk" + std::to_string(i) + ".bin";
+    File* file             = index.Find(path);
+    ASSERT_NE(file, nullptr) << path;
+    EXPECT_EQ(file, archive.FindFile(path));
+  }
+
+  EXPECT_EQ(index.Find("data/level0/chunk1.bin"), nullptr);
+  EXPECT_EQ(index.Find("data/level0"), nullptr);
+  EXPECT_EQ(index.Find("zzz"), nullptr);
+  EXPECT_EQ(index.Find(""), nullptr);
+}
+
+TEST(PathIndex, FrontCodingIsSmallerThanFullPaths) {
+  Archive archive;
+  size_t fullSize = 0;
+  for (size_t i = 0; i < 200; ++i) {
+    const std::string path = "assets/characters/player/animations/run_" + std::to_string(i) + ".anim";
+    fullSize += path.size();
+    archive.AddFile(File(path, MakeBytes("x")));
+  }
+
+  EXPECT_LT(archive.GetPathIndex().GetEncodedSize(), fullSize / 2);
+}
+
+TEST(PathIndex, LeadingSlashIsIgnored) {
+  Archive archive = MakeArchive();
+  EXPECT_NE(archive.GetPathIndex().Find("sounds/ui/click.wem"), nullptr);
+  EXPECT_NE(archive.GetPathIndex().Find("/textures/ui/button.dds"), nullptr);
+}
+
+TEST(PathIndex, RebuiltAfterAddFile) {
+  Archive archive = MakeArchive();
+  ASSERT_EQ(archive.GetPathIndex().GetSize(), 6u);
+
+  archive.AddFile(File("textures/ui/new.dds", MakeBytes("7")));
+  EXPECT_EQ(archive.GetPathIndex().GetSize(), 7u);
+  EXPECT_NE(archive.GetPathIndex().Find("textures/ui/new.dds"), nullptr);
+}
+
+TEST(PathIndex, ManifestIsNotIndexed) {
+  Archive archive = MakeArchive();
+  archive.AddFile(File("PSArcManifest.bin", MakeBytes("manifest")));
+  EXPECT_EQ(archive.GetPathIndex().GetSize(), 6u);
+}
+
+// ---------------------------------------------------------------------------
+// PathIndex — prefix and glob queries
+// ---------------------------------------------------------------------------
+
+TEST(PathIndex, PrefixQueryReturnsSortedSubtree) {
+  Archive archive = MakeArchive();
+
+  EXPECT_EQ(PathsOf(archive.FindFilesWithPrefix("textures/ui/")),
+            (std::vector<std::string> {"textures/ui/button.dds", "textures/ui/icons/star.dds"}));
+  EXPECT_EQ(PathsOf(archive.FindFilesWithPrefix("/textures/ui")).size(), 3u);
+  EXPECT_EQ(archive.FindFilesWithPrefix("").size(), 6u);
+  EXPECT_TRUE(archive.FindFilesWithPrefix("models/").empty());
+}
+
+TEST(PathIndex, GlobQueries) {
+  Archive archive = MakeArchive();
+
+  EXPECT_EQ(PathsOf(archive.FindFilesMatching("textures/ui/*")), (std::vector<std::string> {"textures/ui/button.dds"}));
+  EXPECT_EQ(PathsOf(archive.FindFilesMatching("textures/ui/**")),
+            (std::vector<std::string> {"textures/ui/button.dds", "textures/ui/icons/star.dds"}));
+  EXPECT_EQ(PathsOf(archive.FindFilesMatching("*/ui/*")), (std::vector<std::string> {"sounds/ui/click.wem", "textures/ui/button.dds"}));
+  EXPECT_EQ(archive.FindFilesMatching("**.dds").size(), 4u);
+  EXPECT_EQ(PathsOf(archive.FindFilesMatching("textures/ui?/*.dds")), (std::vector<std::string> {"textures/ui2/panel.dds"}));
+  EXPECT_EQ(PathsOf(archive.FindFilesMatching("readme.txt")), (std::vector<std::string> {"readme.txt"}));
+}
+
+TEST(PathIndex, GlobMatching) {
+  EXPECT_TRUE(PathIndex::MatchesGlob("a/b/c.txt", "a/*/c.txt"));
+  EXPECT_FALSE(PathIndex::MatchesGlob("a/b/d/c.txt", "a/*/c.txt"));
+  EXPECT_TRUE(PathIndex::MatchesGlob("a/b/d/c.txt", "a/**/c.txt"));
+  EXPECT_FALSE(PathIndex::MatchesGlob("a/b", "a?b"));
+  EXPECT_TRUE(PathIndex::MatchesGlob("", "*"));
+  EXPECT_FALSE(PathIndex::MatchesGlob("abc", "ab"));
+  EXPECT_TRUE(PathIndex::MatchesGlob("a/b/c.txt", "**/*.txt"));
+  EXPECT_TRUE(PathIndex::MatchesGlob("c.txt", "**c.txt"));
+  EXPECT_FALSE(PathIndex::MatchesGlob("a/c.txt", "*c.txt"));
+  EXPECT_TRUE(PathIndex::MatchesGlob("a/bc", "a/***c"));
+  EXPECT_TRUE(PathIndex::MatchesGlob("ab/cd", "a*/*d"));
+  EXPECT_FALSE(PathIndex::MatchesGlob("ab/cd/", "a*/*d"));
+}
+
+TEST(PathIndex, GlobstarMatchesNoDirectory) {
+  EXPECT_TRUE(PathIndex::MatchesGlob("a/b.txt", "a/**/b.txt"));
+  EXPECT_TRUE(PathIndex::MatchesGlob("b.txt", "**/b.txt"));
+  EXPECT_TRUE(PathIndex::MatchesGlob("a/b.txt", "**/a/**/b.txt"));
+  EXPECT_FALSE(PathIndex::MatchesGlob("ab.txt", "a/**/b.txt"));
+  // Only a whole "**" component may match no directory.
+  EXPECT_FALSE(PathIndex::MatchesGlob("ab.txt", "a**/b.txt"));
+
+  Archive archive = MakeArchive();
+  EXPECT_EQ(PathsOf(archive.FindFilesMatching("**/readme.txt")), (std::vector<std::string> {"readme.txt"}));
+}
+
+TEST(PathIndex, GlobMatchingDoesNotBacktrack) {
+  // Takes exponential time with a backtracking matcher.
+  const std::string path(40, 'a');
+  EXPECT_FALSE(PathIndex::MatchesGlob(path, "*a*a*a*a*a*a*a*a*b"));
+  EXPECT_FALSE(PathIndex::MatchesGlob(path, "**a**a**a**a**a**a**a**a**b"));
+  EXPECT_TRUE(PathIndex::MatchesGlob(path, "*a*a*a*a*a*a*a*a*a"));
+}